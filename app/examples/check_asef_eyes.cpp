@@ -0,0 +1,150 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/*!
+ * \ingroup cli
+ * \page cli_check_asef_eyes Check ASEF Eyes
+ * Checks that batched ASEFEyes finds the same eyes as one template at a time,
+ * and as the original full tile correlation with separate left and right filters.
+ * A template without a face ROI must be marked FTE without disturbing the rest of its batch.
+ */
+
+#include <QFile>
+#include <QStringList>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <openbr_plugin.h>
+
+// The eye locations of the original implementation, one correlation per eye over the whole tile
+struct Reference
+{
+    cv::Mat leftFilter, rightFilter, lut;
+    cv::Rect leftRect, rightRect;
+    int width, height;
+
+    static cv::Mat normalized(const QByteArray &data, int rows, int cols)
+    {
+        const cv::Mat m(rows, cols, CV_32F, (void*) data.data());
+        cv::Scalar mean, stdDev;
+        cv::meanStdDev(m, mean, stdDev);
+        cv::Mat filter, filterDFT;
+        m.convertTo(filter, -1, 1.0/stdDev[0], -mean[0]/stdDev[0]);
+        cv::dft(filter, filterDFT, CV_DXT_FORWARD);
+        return filterDFT;
+    }
+
+    static cv::Rect rect(const QByteArray &line)
+    {
+        const QList<QByteArray> words = line.simplified().split(' ');
+        return cv::Rect(words[0].toInt(), words[1].toInt(), words[2].toInt(), words[3].toInt());
+    }
+
+    bool load(const QString &fileName)
+    {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly) || (file.readLine().simplified() != "CFEL")) return false;
+        file.readLine();
+        file.readLine();
+        const QList<QByteArray> words = file.readLine().simplified().split(' ');
+        height = words[0].toInt();
+        width = words[1].toInt();
+        leftRect = rect(file.readLine());
+        rightRect = rect(file.readLine());
+        file.readLine();
+        const QByteArray left = file.read(4*width*height), right = file.read(4*width*height);
+        leftFilter = normalized(left, height, width);
+        rightFilter = normalized(right, height, width);
+
+        lut = cv::Mat(256, 1, CV_32F);
+        for (int i=0; i<256; i++) lut.at<float>(i, 0) = std::log((float)i+1);
+        return true;
+    }
+
+    QList<QPointF> locate(const br::Template &src) const
+    {
+        const QRectF face = src.file.ROIs().first();
+        const cv::Rect roi(face.x(), face.y(), face.width(), face.height());
+        cv::Mat gray, tile, image;
+        cv::cvtColor(src.m()(roi), gray, CV_BGR2GRAY);
+        cv::resize(gray, tile, cv::Size(width, height));
+        cv::LUT(tile, lut, image);
+
+        cv::Mat leftCorr, rightCorr;
+        cv::dft(image, image, CV_DXT_FORWARD);
+        cv::mulSpectrums(image, leftFilter, leftCorr, 0, true);
+        cv::mulSpectrums(image, rightFilter, rightCorr, 0, true);
+        cv::dft(leftCorr, leftCorr, CV_DXT_INV_SCALE);
+        cv::dft(rightCorr, rightCorr, CV_DXT_INV_SCALE);
+
+        cv::Point left, right;
+        cv::minMaxLoc(leftCorr(leftRect), NULL, NULL, NULL, &left);
+        cv::minMaxLoc(rightCorr(rightRect), NULL, NULL, NULL, &right);
+        return QList<QPointF>() << QPointF((leftRect.x + left.x)*gray.cols/width+roi.x, (leftRect.y + left.y)*gray.rows/height+roi.y)
+                                << QPointF((rightRect.x + right.x)*gray.cols/width+roi.x, (rightRect.y + right.y)*gray.rows/height+roi.y);
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    br::Context::initialize(argc, argv);
+
+    Reference reference;
+    if (!reference.load(br::Globals->sdkPath + "/share/openbr/models/EyeLocatorASEF128x128.fel")) {
+        printf("Failed to load the ASEF model\n");
+        br::Context::finalize();
+        return 1;
+    }
+
+    // More templates than one batch, with faces of different sizes and positions
+    br::TemplateList templates;
+    cv::RNG rng(0x5050);
+    for (int i=0; i<37; i++) {
+        cv::Mat image(160, 200, CV_8UC3);
+        rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+        cv::GaussianBlur(image, image, cv::Size(0, 0), 3);
+        br::Template t(br::File(QString("synthetic%1").arg(i)), image);
+        const int size = rng.uniform(64, 150);
+        if (i != 20) t.file.appendROI(QRectF(rng.uniform(0, 200-size), rng.uniform(0, 160-size), size, size));
+        templates.append(t);
+    }
+
+    QScopedPointer<br::Transform> eyes(br::Transform::make("ASEFEyes", NULL));
+    br::TemplateList batched;
+    eyes->project(templates, batched);
+
+    int result = 0, mismatches = 0;
+    for (int i=0; i<templates.size(); i++) {
+        if (templates[i].file.ROIs().isEmpty()) {
+            if (!batched[i].file.getBool("FTE")) {
+                printf("%s has no ROI but was not marked FTE\n", qPrintable(templates[i].file.name));
+                result = 1;
+            }
+            continue;
+        }
+
+        br::Template single;
+        eyes->project(templates[i], single);
+        const QList<QPointF> expected = reference.locate(templates[i]);
+        if ((batched[i].file.landmarks() != single.file.landmarks()) || (single.file.landmarks() != expected)) {
+            if (mismatches++ < 10) printf("%s eyes differ between batched, single and reference localization\n", qPrintable(templates[i].file.name));
+            result = 1;
+        }
+    }
+    printf("%d of %d templates differ\n", mismatches, templates.size()-1);
+
+    br::Context::finalize();
+    return result;
+}
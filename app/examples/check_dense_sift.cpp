@@ -0,0 +1,64 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/*!
+ * \ingroup cli
+ * \page cli_check_dense_sift Check Dense SIFT
+ * Measures how far DenseSIFTDescriptor is from SIFTDescriptor on a synthetic image.
+ * The descriptors differ slightly because of the key point angle, this bounds the difference.
+ */
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <openbr_plugin.h>
+
+int main(int argc, char *argv[])
+{
+    br::Context::initialize(argc, argv);
+
+    cv::Mat image(96, 96, CV_8UC1);
+    cv::RNG rng(0x5151);
+    rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    cv::GaussianBlur(image, image, cv::Size(0, 0), 2);
+
+    br::Template src(br::File("synthetic"), image);
+    for (int y=16; y<=80; y+=8)
+        for (int x=16; x<=80; x+=8)
+            src.file.appendLandmark(QPointF(x, y));
+
+    QScopedPointer<br::Transform> sift(br::Transform::make("SIFTDescriptor(12)", NULL));
+    QScopedPointer<br::Transform> dense(br::Transform::make("DenseSIFTDescriptor(12)", NULL));
+    const cv::Mat a = (*sift)(src).m();
+    const cv::Mat b = (*dense)(src).m();
+
+    int result = 0;
+    if ((a.rows != b.rows) || (a.cols != b.cols)) {
+        printf("Descriptor sizes differ: %dx%d and %dx%d\n", a.rows, a.cols, b.rows, b.cols);
+        result = 1;
+    } else {
+        double sum = 0, worst = 0;
+        for (int i=0; i<a.rows; i++) {
+            const double error = cv::norm(a.row(i), b.row(i), cv::NORM_L2) / std::max(cv::norm(a.row(i), cv::NORM_L2), 1.0);
+            sum += error;
+            worst = std::max(worst, error);
+        }
+        const double mean = sum / a.rows;
+        printf("Relative L2 error over %d descriptors: mean %.4f, max %.4f\n", a.rows, mean, worst);
+        if (mean > 0.1) result = 1;
+    }
+
+    br::Context::finalize();
+    return result;
+}
@@ -0,0 +1,79 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/*!
+ * \ingroup cli
+ * \page cli_check_float_output Check Float Output
+ * Checks that scores written by the csv output match QString::number(),
+ * including values that round on a tie and values at the fixed and scientific notation boundaries.
+ */
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <opencv2/core/core.hpp>
+#include <openbr_plugin.h>
+
+int main(int argc, char *argv[])
+{
+    br::Context::initialize(argc, argv);
+
+    QList<float> values;
+    values << 0 << 1 << -1 << 0.5f << 1.5f << 2.5f << 100000.5f << -100000.5f << 123456.5f << 999999.4f << 999999.5f << 1e6f
+           << 1234565.f << 0.1234565f << 12345.65f << 1e-4f << 9.999995e-5f << 0.00012345675f << 1e-5f << 3.4e38f << 1e-38f;
+    cv::RNG rng(0x4242);
+    for (int i=0; i<10000; i++)
+        values.append(float(rng.uniform(-1.0, 1.0) * pow(10.0, rng.uniform(-6, 8))));
+
+    br::FileList targets, queries;
+    for (int j=0; j<values.size(); j++)
+        targets.append(br::File(QString("t%1").arg(j)));
+    queries.append(br::File("query"));
+
+    const QString fileName = QDir::temp().filePath("check_float_output.csv");
+    {
+        QScopedPointer<br::Output> output(br::Output::make(fileName, targets, queries));
+        output->setBlock(0, 0);
+        for (int j=0; j<values.size(); j++)
+            output->setRelative(values[j], 0, j);
+    }
+
+    QFile file(fileName);
+    file.open(QFile::ReadOnly);
+    file.readLine();
+    const QStringList fields = QString(file.readLine()).trimmed().split(',');
+    file.close();
+    QFile::remove(fileName);
+
+    int result = 0;
+    if (fields.size() != values.size()+1) {
+        printf("Expected %d fields but got %d\n", values.size()+1, fields.size());
+        result = 1;
+    } else {
+        int mismatches = 0;
+        for (int j=0; j<values.size(); j++) {
+            const QString expected = QString::number(values[j]);
+            if (fields[j+1] == expected) continue;
+            if (mismatches++ < 10) printf("%.9g written as %s, expected %s\n", values[j], qPrintable(fields[j+1]), qPrintable(expected));
+        }
+        printf("%d of %d values differ from QString::number()\n", mismatches, values.size());
+        if (mismatches > 0) result = 1;
+    }
+
+    br::Context::finalize();
+    return result;
+}
@@ -0,0 +1,91 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/*!
+ * \ingroup cli
+ * \page cli_check_matrix_pool Check Matrix Pool
+ * Counts the matrices the stock face recognition pipeline allocates from the matrix pool when templates are projected one at a time.
+ * Once the pool is warm every allocation must be served from it without going to the system allocator,
+ * and the features must be bit for bit those computed with br::Context::poolMatrices disabled.
+ */
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <openbr_plugin.h>
+
+static bool equal(const br::Template &a, const br::Template &b)
+{
+    if (a.size() != b.size()) return false;
+    for (int i=0; i<a.size(); i++)
+        if ((a[i].size() != b[i].size()) || (a[i].type() != b[i].type()) ||
+            (cv::countNonZero(a[i].reshape(1, 1) != b[i].reshape(1, 1)) != 0)) return false;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    br::Context::initialize(argc, argv);
+
+    // Gray images with a face ROI, as produced by FaceDetection
+    br::TemplateList templates;
+    cv::RNG rng(0x3030);
+    for (int i=0; i<12; i++) {
+        cv::Mat image(160, 200, CV_8UC1);
+        rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+        cv::GaussianBlur(image, image, cv::Size(0, 0), 3);
+        br::Template t(br::File(QString("synthetic%1").arg(i)), image);
+        const int size = rng.uniform(64, 150);
+        t.file.appendROI(QRectF(rng.uniform(0, 200-size), rng.uniform(0, 160-size), size, size));
+        templates.append(t);
+    }
+
+    // FaceRecognitionNoTraining after FaceDetection
+    QScopedPointer<br::Transform> pipeline(br::Transform::make("ASEFEyes+Affine(86,86,0.25,0.35)+Blur(1.1)+Gamma(0.2)+DoG(1,2)+ContrastEq(0.1,10)+Mask+LBP(1,2)+RectRegions(8,8,6,6)+Hist(59)+Cat", NULL));
+
+    br::Globals->poolMatrices = false;
+    br::TemplateList expected;
+    foreach (const br::Template &t, templates)
+        expected.append((*pipeline)(t));
+
+    // Warm the pool, then count a second pass, releasing each template before the next
+    br::Globals->poolMatrices = true;
+    foreach (const br::Template &t, templates)
+        (*pipeline)(t);
+    br::matrixAllocations(NULL, NULL, true);
+
+    int result = 0;
+    for (int i=0; i<templates.size(); i++)
+        if (!equal((*pipeline)(templates[i]), expected[i])) {
+            printf("%s differs from its features computed without the matrix pool\n", qPrintable(templates[i].file.name));
+            result = 1;
+        }
+
+    int allocations, mallocs;
+    br::matrixAllocations(&allocations, &mallocs);
+    printf("%.1f pooled allocations and %.1f system allocations per template\n",
+           float(allocations)/templates.size(), float(mallocs)/templates.size());
+    if (allocations == 0) {
+        printf("The single template projection path does not allocate from the matrix pool\n");
+        result = 1;
+    }
+    if (mallocs != 0) {
+        printf("The warm matrix pool went to the system allocator\n");
+        result = 1;
+    }
+
+    br::Context::finalize();
+    return result;
+}
@@ -0,0 +1,67 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/*!
+ * \ingroup cli
+ * \page cli_check_region_hist Check Region Hist
+ * Checks that RegionHist computes bit for bit the histograms of RectRegions+Hist, with and without Cat.
+ */
+
+#include <opencv2/core/core.hpp>
+#include <openbr_plugin.h>
+
+static bool equal(const br::Template &a, const br::Template &b)
+{
+    if (a.size() != b.size()) {
+        printf("Expected %d matrices but got %d\n", b.size(), a.size());
+        return false;
+    }
+    for (int i=0; i<a.size(); i++) {
+        if ((a[i].size() != b[i].size()) || (a[i].type() != b[i].type()) ||
+            (memcmp(a[i].clone().data, b[i].clone().data, a[i].total()*a[i].elemSize()) != 0)) {
+            printf("Matrix %d differs\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    br::Context::initialize(argc, argv);
+
+    // LBP(1,2) codes of an 86x86 face
+    cv::Mat image(86, 86, CV_8UC1);
+    cv::RNG rng(0x4848);
+    rng.fill(image, cv::RNG::UNIFORM, 0, 59);
+    const br::Template src(br::File("synthetic"), image);
+
+    int result = 0;
+    const QStringList pairs = QStringList() << "RegionHist(8,8,6,6,59,cat=false)" << "RectRegions(8,8,6,6)+Hist(59)"
+                                            << "RegionHist(8,8,6,6,59)" << "RectRegions(8,8,6,6)+Hist(59)+Cat"
+                                            << "RegionHist(10,12,-1,-1,40,10,15,cat=false)" << "RectRegions(10,12)+Hist(40,10,15)";
+    for (int i=0; i<pairs.size(); i+=2) {
+        QScopedPointer<br::Transform> fast(br::Transform::make(pairs[i], NULL));
+        QScopedPointer<br::Transform> reference(br::Transform::make(pairs[i+1], NULL));
+        const bool same = equal((*fast)(src), (*reference)(src));
+        printf("%s %s %s\n", qPrintable(pairs[i]), same ? "matches" : "differs from", qPrintable(pairs[i+1]));
+        if (!same) result = 1;
+    }
+
+    br::Context::finalize();
+    return result;
+}
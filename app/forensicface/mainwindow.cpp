@@ -21,6 +21,8 @@ MainWindow::MainWindow(QWidget *parent)
     connect(&algorithm, SIGNAL(newAlgorithm(QString)), ui->tTail, SLOT(setAlgorithm(QString)));
     connect(ui->tTail, SIGNAL(newTargetFiles(br::FileList)), ui->gvTarget, SLOT(setFiles(br::FileList)));
     connect(ui->tTail, SIGNAL(newQueryFiles(br::FileList)), ui->gvQuery, SLOT(setFiles(br::FileList)));
+    connect(ui->tTail, SIGNAL(prefetchTargetFiles(br::FileList)), ui->gvTarget, SLOT(prefetch(br::FileList)));
+    connect(ui->tTail, SIGNAL(prefetchQueryFiles(br::FileList)), ui->gvQuery, SLOT(prefetch(br::FileList)));
     connect(ui->vView, SIGNAL(newFormat(QString)), &ui->gvTarget->tvgTemplateViewerGrid, SLOT(setFormat(QString)));
     connect(ui->vView, SIGNAL(newFormat(QString)), &ui->gvQuery->tvgTemplateViewerGrid, SLOT(setFormat(QString)));
     connect(ui->vView, SIGNAL(newCount(int)), ui->tTail, SLOT(setCount(int)));
@@ -43,4 +43,9 @@ void GalleryViewer::setFiles(FileList files)
         tmTemplateMetadata.setFile(files.first());
 }
 
+void GalleryViewer::prefetch(const FileList &files)
+{
+    tvgTemplateViewerGrid.prefetch(files);
+}
+
 #include "moc_galleryviewer.cpp"
@@ -26,6 +26,7 @@ public:
 public slots:
     void setAlgorithm(const QString &algorithm);
     void setFiles(br::FileList files);
+    void prefetch(const br::FileList &files);
 };
 
 } // namespace br
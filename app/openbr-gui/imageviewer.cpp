@@ -36,24 +36,35 @@ void br::ImageViewer::setDefaultText(const QString &text, bool async)
 
 void br::ImageViewer::setImage(const QString &file, bool async)
 {
-    src = QImage(file);
+    setSource(QImage(file));
     updatePixmap(async);
 
 }
 
 void br::ImageViewer::setImage(const QImage &image, bool async)
 {
-    src = image;
+    setSource(image);
     updatePixmap(async);
 }
 
 void br::ImageViewer::setImage(const QPixmap &pixmap, bool async)
 {
-    src = pixmap.toImage();
+    setSource(pixmap.toImage());
     updatePixmap(async);
 }
 
 /*** PRIVATE ***/
+void br::ImageViewer::setSource(const QImage &image)
+{
+    src = image;
+    scaledSize = QSize();
+
+    // Thumbnails record the resolution they were made from so points map to the original image
+    const int width = src.text("SourceWidth").toInt();
+    const int height = src.text("SourceHeight").toInt();
+    sourceSize = ((width > 0) && (height > 0)) ? QSize(width, height) : src.size();
+}
+
 void br::ImageViewer::updatePixmap(bool async)
 {
     if (async) {
@@ -64,8 +75,9 @@ void br::ImageViewer::updatePixmap(bool async)
     if (src.isNull()) {
         QLabel::setPixmap(QPixmap());
         setText(defaultText);
-    } else {
+    } else if (scaledSize != size()) {
         QLabel::setPixmap(QPixmap::fromImage(src.scaled(size(), Qt::KeepAspectRatio)));
+        scaledSize = size();
     }
 }
 
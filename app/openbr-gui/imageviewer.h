@@ -23,6 +23,7 @@
 #include <QMouseEvent>
 #include <QPixmap>
 #include <QResizeEvent>
+#include <QSize>
 #include <QString>
 #include <QWidget>
 #include <openbr_export.h>
@@ -35,6 +36,8 @@ class BR_EXPORT_GUI ImageViewer : public QLabel
     Q_OBJECT
     QString defaultText;
     QImage src;
+    QSize sourceSize; // Of the image src was scaled from
+    QSize scaledSize; // Of the pixmap last made from src, empty when it needs redrawing
 
 public:
     explicit ImageViewer(QWidget *parent = 0);
@@ -43,14 +46,17 @@ public:
     void setImage(const QImage &image, bool async = false);
     void setImage(const QPixmap &pixmap, bool async = false);
     bool isNull() const { return src.isNull(); }
-    int imageWidth() const { return src.width(); }
-    int imageHeight() const { return src.height(); }
+    int imageWidth() const { return sourceSize.width(); }
+    int imageHeight() const { return sourceSize.height(); }
 
 protected slots:
     void keyPressEvent(QKeyEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void resizeEvent(QResizeEvent *event);
 
+private:
+    void setSource(const QImage &image);
+
 private slots:
     void updatePixmap(bool async = false);
 };
@@ -3,7 +3,10 @@
 #include <QFileInfo>
 #include <QFileDialog>
 #include <QIcon>
+#include <QMetaObject>
+#include <QMutexLocker>
 #include <QPen>
+#include <QtConcurrentRun>
 #include <openbr.h>
 
 #include "tail.h"
@@ -43,6 +46,7 @@ Tail::Tail(QWidget *parent)
     count = 9;
     index = 0;
     targetLocked = queryLocked = false;
+    comparing = false;
     updateInterface();
 
     connect(&dDataset, SIGNAL(newDistribution(QString)), &sdScoreDistribution, SLOT(setDistribution(QString)));
@@ -51,6 +55,36 @@ Tail::Tail(QWidget *parent)
     connect(&tbPrevious, SIGNAL(clicked()), this, SLOT(previous()));
     connect(&tbNext, SIGNAL(clicked()), this, SLOT(next()));
     connect(&tbLast, SIGNAL(clicked()), this, SLOT(last()));
+    connect(&comparison, SIGNAL(finished()), this, SLOT(compared()));
+    Output::addObserver(this);
+}
+
+Tail::~Tail()
+{
+    {
+        QMutexLocker locker(&snapshotLock);
+        tailFile.clear(); // Cancels the comparison in progress
+    }
+    comparison.waitForFinished();
+    Output::removeObserver(this);
+}
+
+void Tail::snapshot(const File &output, const QList<float> &scores, const FileList &targets, const FileList &queries)
+{
+    // Called from the comparison thread
+    QMutexLocker locker(&snapshotLock);
+    if (output.name != tailFile) return;
+    snapshotScores = scores;
+    snapshotTargets = targets;
+    snapshotQueries = queries;
+    QMetaObject::invokeMethod(this, "refresh", Qt::QueuedConnection);
+}
+
+bool Tail::cancelled(const File &output)
+{
+    // Called from the comparison thread, a comparison is stale once another has been requested
+    QMutexLocker locker(&snapshotLock);
+    return (output.name == comparedFile) && (comparedFile != tailFile);
 }
 
 /*** PUBLIC SLOTS ***/
@@ -70,6 +104,11 @@ void Tail::setIndex(int index)
 
     emit newTargetFiles(targets.mid(index, count));
     emit newQueryFiles(queries.mid(index, count));
+
+    // The pages next() and previous() would show
+    const int nextIndex = std::max(0, index - count);
+    emit prefetchTargetFiles(targets.mid(index + count, count) + targets.mid(nextIndex, index - nextIndex));
+    emit prefetchQueryFiles(queries.mid(index + count, count) + queries.mid(nextIndex, index - nextIndex));
 }
 
 void Tail::setTargetGallery(const File &gallery)
@@ -139,13 +178,53 @@ void Tail::wheelEvent(QWheelEvent *event)
 void Tail::compare()
 {
     if (target.isNull() || query.isNull()) return;
-    QString tail = QString("%1/comparisons/%2_%3.tail[atMost=5000,threshold=1,args,Cache]").arg(br_scratch_path(), qPrintable(target.baseName()+target.hash()), qPrintable(query.baseName()+query.hash()));
-    Compare(target.flat(), query.flat(), tail);
-    import(tail);
-    QFile::remove(tail);
+
+    // Compare in the background, refreshing from snapshots of the best matches as they are found.
+    // A comparison in progress is cancelled and compared() starts this one when it returns.
+    {
+        QMutexLocker locker(&snapshotLock);
+        tailFile = QString("%1/comparisons/%2_%3.tail").arg(br_scratch_path(), qPrintable(target.baseName()+target.hash()), qPrintable(query.baseName()+query.hash()));
+    }
+    if (!comparing) startComparison();
+}
+
+void Tail::startComparison()
+{
+    {
+        QMutexLocker locker(&snapshotLock);
+        comparedFile = tailFile;
+    }
+    comparing = true;
+
+    // Visit the most promising target blocks first
+    comparison.setFuture(QtConcurrent::run(&br::Compare, File(target.flat()), File(query.flat()), File(comparedFile+"[atMost=5000,threshold=1,args,Cache,interval=250,prefilter=16]")));
 }
 
 /*** PRIVATE SLOTS ***/
+void Tail::compared()
+{
+    comparing = false;
+    const bool current = (comparedFile == tailFile);
+    if (current) import(comparedFile);
+    QFile::remove(comparedFile);
+    if (!current && !tailFile.isEmpty()) startComparison();
+}
+
+void Tail::refresh()
+{
+    {
+        QMutexLocker locker(&snapshotLock);
+        if (snapshotScores.isEmpty()) return;
+        scores = snapshotScores;
+        targets = snapshotTargets;
+        queries = snapshotQueries;
+        snapshotScores.clear();
+    }
+
+    sdScoreDistribution.setLiveScores(scores);
+    setIndex(index);
+}
+
 void Tail::updateInterface()
 {
     tbFirst.setEnabled(index < scores.size() - count);
@@ -2,8 +2,10 @@
 #define TAIL_H
 
 #include <QLabel>
+#include <QFutureWatcher>
 #include <QKeyEvent>
 #include <QMainWindow>
+#include <QMutex>
 #include <QString>
 #include <QToolBar>
 #include <QToolButton>
@@ -18,7 +20,7 @@
 namespace br
 {
 
-class BR_EXPORT_GUI Tail : public QMainWindow
+class BR_EXPORT_GUI Tail : public QMainWindow, public br::OutputObserver
 {
     Q_OBJECT
     QToolBar tbToolBar;
@@ -36,8 +38,19 @@ class BR_EXPORT_GUI Tail : public QMainWindow
     br::FileList targets, queries;
     QList<float> scores;
 
+    QString tailFile; // Requested comparison
+    QString comparedFile; // Comparison in progress
+    bool comparing; // Until compared() handles comparedFile
+    QFutureWatcher<void> comparison;
+    QMutex snapshotLock;
+    br::FileList snapshotTargets, snapshotQueries;
+    QList<float> snapshotScores;
+
 public:
     explicit Tail(QWidget *parent = 0);
+    ~Tail();
+    void snapshot(const br::File &output, const QList<float> &scores, const br::FileList &targets, const br::FileList &queries);
+    bool cancelled(const br::File &output);
 
 public slots:
     void setAlgorithm(const QString &algorithm);
@@ -55,8 +68,11 @@ protected:
 
 private:
     void compare();
+    void startComparison();
 
 private slots:
+    void compared();
+    void refresh();
     void updateInterface();
     void import(QString tailFile = "");
     void first();
@@ -69,6 +85,8 @@ private slots:
 signals:
     void newTargetFiles(br::FileList files);
     void newQueryFiles(br::FileList files);
+    void prefetchTargetFiles(br::FileList files);
+    void prefetchQueryFiles(br::FileList files);
 };
 
 } // namespace br
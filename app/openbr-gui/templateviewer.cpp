@@ -2,10 +2,10 @@
 #include <QPainter>
 #include <QPen>
 #include <QUrl>
-#include <QtConcurrentRun>
 #include <openbr.h>
 
 #include "templateviewer.h"
+#include "thumbnailcache.h"
 
 using namespace br;
 
@@ -26,11 +26,18 @@ TemplateViewer::TemplateViewer(QWidget *parent)
     setMouseTracking(true);
     setText("<b>Drag Photo or Folder Here</b>\n");
     format = "Registered";
+    thumbnailLevel = ThumbnailCache::level(size());
     editable = true;
+    connect(ThumbnailCache::instance(), SIGNAL(ready(QString,QImage)), this, SLOT(thumbnailReady(QString,QImage)));
     setFile(File());
     update();
 }
 
+TemplateViewer::~TemplateViewer()
+{
+    ThumbnailCache::instance()->release(this);
+}
+
 /*** PUBLIC SLOTS ***/
 void TemplateViewer::setFile(const File &file_)
 {
@@ -46,7 +53,7 @@ void TemplateViewer::setFile(const File &file_)
         landmarks.append(QPointF());
     nearestLandmark = -1;
 
-    QtConcurrent::run(this, &TemplateViewer::refreshImage);
+    refreshImage();
 }
 
 void TemplateViewer::setEditable(bool enabled)
@@ -64,28 +71,14 @@ void TemplateViewer::setMousePoint(const QPointF &mousePoint)
 void TemplateViewer::setFormat(const QString &format)
 {
     this->format = format;
-    QtConcurrent::run(this, &TemplateViewer::refreshImage);
+    refreshImage();
 }
 
 /*** PRIVATE ***/
 void TemplateViewer::refreshImage()
 {
-    if (file.isNull() || (format == "Photo")) {
-        setImage(file, true);
-    } else {
-        const QString path = QString(br_scratch_path()) + "/thumbnails";
-        const QString hash = file.hash()+format;
-        const QString processedFile = path+"/"+file.baseName()+hash+".png";
-        if (!QFileInfo(processedFile).exists()) {
-            if (format == "Registered")
-                Enroll(file.flat(), path+"[postfix="+hash+",cache,algorithm=RegisterAffine]");
-            else if (format == "Enhanced")
-                Enroll(file.flat(), path+"[postfix="+hash+",cache,algorithm=ContrastEnhanced]");
-            else if (format == "Features")
-                Enroll(file.flat(), path+"[postfix="+hash+",cache,algorithm=ColoredLBP]");
-        }
-        setImage(processedFile, true);
-    }
+    thumbnailLevel = ThumbnailCache::level(size());
+    setImage(ThumbnailCache::instance()->request(this, file, format, size(), &thumbnailKey)); // Null until decoded
 }
 
 QPointF TemplateViewer::getImagePoint(const QPointF &sp) const
@@ -138,6 +131,12 @@ void TemplateViewer::dropEvent(QDropEvent *event)
     }
 }
 
+void TemplateViewer::hideEvent(QHideEvent *event)
+{
+    ImageViewer::hideEvent(event);
+    ThumbnailCache::instance()->release(this);
+}
+
 void TemplateViewer::leaveEvent(QEvent *event)
 {
     ImageViewer::leaveEvent(event);
@@ -250,4 +249,19 @@ void TemplateViewer::paintEvent(QPaintEvent *event)
     }
 }
 
+void TemplateViewer::resizeEvent(QResizeEvent *event)
+{
+    ImageViewer::resizeEvent(event);
+    if (ThumbnailCache::level(size()) != thumbnailLevel)
+        refreshImage();
+}
+
+/*** PRIVATE SLOTS ***/
+void TemplateViewer::thumbnailReady(const QString &key, const QImage &image)
+{
+    if (key != thumbnailKey) return;
+    ThumbnailCache::instance()->release(this);
+    setImage(image);
+}
+
 #include "moc_templateviewer.cpp"
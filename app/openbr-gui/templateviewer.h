@@ -4,10 +4,12 @@
 #include <QDragEnterEvent>
 #include <QDropEvent>
 #include <QEvent>
+#include <QHideEvent>
 #include <QImage>
 #include <QList>
 #include <QMouseEvent>
 #include <QPointF>
+#include <QResizeEvent>
 #include <QString>
 #include <QWidget>
 #include <openbr_plugin.h>
@@ -23,6 +25,8 @@ class BR_EXPORT_GUI TemplateViewer : public br::ImageViewer
     br::File file;
     QPointF mousePoint;
     QString format;
+    QString thumbnailKey;
+    int thumbnailLevel;
 
     bool editable;
     QList<QPointF> landmarks;
@@ -30,6 +34,7 @@ class BR_EXPORT_GUI TemplateViewer : public br::ImageViewer
 
 public:
     explicit TemplateViewer(QWidget *parent = 0);
+    ~TemplateViewer();
 
 public slots:
     void setFile(const br::File &file);
@@ -45,10 +50,15 @@ private:
 protected slots:
     void dragEnterEvent(QDragEnterEvent *event);
     void dropEvent(QDropEvent *event);
+    void hideEvent(QHideEvent *event);
     void leaveEvent(QEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void mousePressEvent(QMouseEvent *event);
     void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+
+private slots:
+    void thumbnailReady(const QString &key, const QImage &image);
 
 signals:
     void newInput(br::File input);
@@ -1,4 +1,5 @@
 #include "templateviewergrid.h"
+#include "thumbnailcache.h"
 
 using namespace br;
 
@@ -7,6 +8,7 @@ using namespace br;
 TemplateViewerGrid::TemplateViewerGrid(QWidget *parent)
     : QWidget(parent)
 {
+    format = "Registered";
     setLayout(&gridLayout);
     setFiles(FileList(16));
     setFiles(FileList(1));
@@ -47,8 +49,15 @@ void TemplateViewerGrid::setFiles(const FileList &files)
     }
 }
 
+void TemplateViewerGrid::prefetch(const FileList &files)
+{
+    // Pages are the same size so the first viewer's size is the one they'll be shown at
+    ThumbnailCache::instance()->prefetch(files, format, templateViewers.first()->size());
+}
+
 void TemplateViewerGrid::setFormat(const QString &format)
 {
+    this->format = format;
     foreach (const QSharedPointer<TemplateViewer> &templateViewer, templateViewers)
         templateViewer->setFormat(format);
 }
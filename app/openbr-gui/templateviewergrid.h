@@ -17,12 +17,14 @@ class BR_EXPORT_GUI TemplateViewerGrid : public QWidget
 
     QGridLayout gridLayout;
     QList< QSharedPointer<TemplateViewer> > templateViewers;
+    QString format;
 
 public:
     explicit TemplateViewerGrid(QWidget *parent = 0);
 
 public slots:
     void setFiles(const br::FileList &file);
+    void prefetch(const br::FileList &files);
     void setFormat(const QString &format);
     void setMousePoint(const QPointF &mousePoint);
 
@@ -0,0 +1,213 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <openbr.h>
+
+#include "thumbnailcache.h"
+
+using namespace br;
+
+/*** STATIC ***/
+static const int Levels[] = { 128, 256, 512, 1024 }; // Longest side of the cached resolutions
+static const int NumLevels = sizeof(Levels) / sizeof(int);
+static const int MaxCachedKB = 256 * 1024;
+
+static QString thumbnailPath()
+{
+    return QString(br_scratch_path()) + "/thumbnails";
+}
+
+// Runs in the decode pool
+static QImage load(const File &file, const QString &format, int level)
+{
+    const QString path = thumbnailPath();
+    const QString hash = file.hash()+format;
+
+    QString source;
+    if (format == "Photo") {
+        source = file.name;
+    } else {
+        source = path+"/"+file.baseName()+hash+".png";
+        if (!QFileInfo(source).exists()) {
+            if (format == "Registered")
+                Enroll(file.flat(), path+"[postfix="+hash+",cache,algorithm=RegisterAffine]");
+            else if (format == "Enhanced")
+                Enroll(file.flat(), path+"[postfix="+hash+",cache,algorithm=ContrastEnhanced]");
+            else if (format == "Features")
+                Enroll(file.flat(), path+"[postfix="+hash+",cache,algorithm=ColoredLBP]");
+        }
+    }
+
+    if (level < 0) return QImage(source);
+
+    const QString thumbnail = QString("%1/%2/%3%4.png").arg(path, QString::number(Levels[level]), file.baseName(), hash);
+    const QFileInfo thumbnailInfo(thumbnail);
+    if (thumbnailInfo.exists() && (thumbnailInfo.lastModified() >= QFileInfo(source).lastModified())) {
+        const QImage image(thumbnail);
+        if (!image.isNull()) return image;
+    }
+
+    QImage image(source);
+    if (image.isNull()) return image;
+    if (std::max(image.width(), image.height()) > Levels[level]) {
+        const QSize sourceSize = image.size();
+        image = image.scaled(Levels[level], Levels[level], Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        image.setText("SourceWidth", QString::number(sourceSize.width())); // Read by ImageViewer, saved with the png
+        image.setText("SourceHeight", QString::number(sourceSize.height()));
+    }
+    QDir().mkpath(thumbnailInfo.absolutePath());
+    image.save(thumbnail);
+    return image;
+}
+
+class ThumbnailDecoder : public QRunnable
+{
+    ThumbnailCache *cache;
+    QString key;
+    File file;
+    QString format;
+    int level;
+
+public:
+    ThumbnailDecoder(ThumbnailCache *cache_, const QString &key_, const File &file_, const QString &format_, int level_)
+        : cache(cache_), key(key_), file(file_), format(format_), level(level_) {}
+
+    void run()
+    {
+        const bool cancelled = !cache->wanted(key);
+        const QImage image = cancelled ? QImage() : load(file, format, level);
+        QMetaObject::invokeMethod(cache, "decoded", Qt::QueuedConnection, Q_ARG(QString, key), Q_ARG(QImage, image), Q_ARG(bool, cancelled));
+    }
+};
+
+/*** PUBLIC ***/
+ThumbnailCache *ThumbnailCache::instance()
+{
+    static ThumbnailCache *cache = new ThumbnailCache();
+    return cache;
+}
+
+int ThumbnailCache::level(const QSize &size)
+{
+    const int side = std::max(size.width(), size.height());
+    for (int i=0; i<NumLevels; i++)
+        if (side <= Levels[i]) return i;
+    return -1;
+}
+
+QImage ThumbnailCache::request(QObject *requester, const File &file, const QString &format, const QSize &size, QString *key)
+{
+    release(requester);
+    key->clear();
+    if (file.isNull()) return QImage();
+
+    Decode decode;
+    decode.file = file;
+    decode.format = format;
+    decode.level = level(size);
+    *key = file.hash()+format+":"+QString::number(decode.level);
+
+    if (QImage *image = images.object(*key))
+        return *image;
+
+    requests.insert(requester, *key);
+    want(*key);
+    if (!queued.contains(*key)) start(*key, decode, 1);
+    return QImage();
+}
+
+void ThumbnailCache::release(QObject *requester)
+{
+    if (requests.contains(requester))
+        unwant(requests.take(requester));
+}
+
+void ThumbnailCache::prefetch(const FileList &files, const QString &format, const QSize &size)
+{
+    foreach (const QString &key, prefetches)
+        unwant(key);
+    prefetches.clear();
+
+    Decode decode;
+    decode.format = format;
+    decode.level = level(size);
+    foreach (const File &file, files) {
+        if (file.isNull()) continue;
+        decode.file = file;
+        const QString key = file.hash()+format+":"+QString::number(decode.level);
+        if (images.contains(key)) continue;
+        prefetches.append(key);
+        want(key);
+        if (!queued.contains(key)) start(key, decode, 0);
+    }
+}
+
+bool ThumbnailCache::wanted(const QString &key)
+{
+    QMutexLocker locker(&demandLock);
+    return demand.value(key) > 0;
+}
+
+/*** PRIVATE ***/
+ThumbnailCache::ThumbnailCache()
+{
+    images.setMaxCost(MaxCachedKB);
+    pool.setMaxThreadCount(std::max(2, QThread::idealThreadCount()/2));
+}
+
+void ThumbnailCache::start(const QString &key, const Decode &decode, int priority)
+{
+    queued.insert(key, decode);
+    pool.start(new ThumbnailDecoder(this, key, decode.file, decode.format, decode.level), priority);
+}
+
+void ThumbnailCache::want(const QString &key)
+{
+    QMutexLocker locker(&demandLock);
+    demand[key]++;
+}
+
+void ThumbnailCache::unwant(const QString &key)
+{
+    QMutexLocker locker(&demandLock);
+    if (--demand[key] <= 0) demand.remove(key);
+}
+
+/*** PRIVATE SLOTS ***/
+void ThumbnailCache::decoded(const QString &key, const QImage &image, bool cancelled)
+{
+    const Decode decode = queued.take(key);
+    if (cancelled) {
+        // Requested again after the decoder gave up on it
+        if (wanted(key)) start(key, decode, 1);
+        return;
+    }
+
+    if (!image.isNull())
+        images.insert(key, new QImage(image), std::max(1, image.byteCount() / 1024));
+    for (int n=prefetches.removeAll(key); n>0; n--)
+        unwant(key);
+    emit ready(key, image);
+}
+
+#include "moc_thumbnailcache.cpp"
@@ -0,0 +1,92 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __THUMBNAILCACHE_H
+#define __THUMBNAILCACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <openbr_plugin.h>
+
+namespace br
+{
+
+/*!
+ * \brief Shared source of template images for the viewers.
+ *
+ * Images are kept at a few fixed resolutions on disk under <tt>br_scratch_path()/thumbnails</tt>
+ * and in a least recently used cache in memory.
+ * Misses are decoded by a small thread pool and announced with ready().
+ * A request replaces the requester's previous one, and decodes nobody is waiting for any more are skipped.
+ */
+class BR_EXPORT_GUI ThumbnailCache : public QObject
+{
+    Q_OBJECT
+
+    struct Decode
+    {
+        br::File file;
+        QString format;
+        int level;
+    };
+
+    QThreadPool pool;
+    QCache<QString,QImage> images;
+    QHash<QObject*,QString> requests;
+    QStringList prefetches;
+    QHash<QString,Decode> queued;
+    QMutex demandLock;
+    QHash<QString,int> demand; // Requests per key, read by the decoders
+
+    ThumbnailCache();
+
+public:
+    static ThumbnailCache *instance(); /*!< \brief The cache shared by every viewer. */
+    static int level(const QSize &size); /*!< \brief The resolution index needed to fill \em size, or \c -1 for full resolution. */
+
+    /*!
+     * \brief The image for \em file in \em format large enough for \em size.
+     *
+     * Returns a null image and emits ready() later if it isn't in memory.
+     * \em key identifies the image in ready().
+     */
+    QImage request(QObject *requester, const br::File &file, const QString &format, const QSize &size, QString *key);
+    void release(QObject *requester); /*!< \brief Forget the requester's pending request. */
+    void prefetch(const br::FileList &files, const QString &format, const QSize &size); /*!< \brief Decode images likely to be requested next, replacing the last prefetch. */
+    bool wanted(const QString &key); /*!< \brief \c true if someone is still waiting on \em key. */
+
+signals:
+    void ready(const QString &key, const QImage &image);
+
+private slots:
+    void decoded(const QString &key, const QImage &image, bool cancelled);
+
+private:
+    void start(const QString &key, const Decode &decode, int priority);
+    void want(const QString &key);
+    void unwant(const QString &key);
+};
+
+} // namespace br
+
+#endif // __THUMBNAILCACHE_H
@@ -11,17 +11,9 @@ QImage toQImage(const Mat &mat)
     // Convert to 8U depth
     Mat mat8u;
     if (mat.depth() != CV_8U) {
-        double globalMin = std::numeric_limits<double>::max();
-        double globalMax = -std::numeric_limits<double>::max();
-
-        std::vector<Mat> mv;
-        split(mat, mv);
-        for (size_t i=0; i<mv.size(); i++) {
-            double min, max;
-            minMaxLoc(mv[i], &min, &max);
-            globalMin = std::min(globalMin, min);
-            globalMax = std::max(globalMax, max);
-        }
+        // Global range across channels without splitting them
+        double globalMin, globalMax;
+        minMaxLoc(mat.reshape(1), &globalMin, &globalMax);
         assert(globalMax >= globalMin);
 
         double range = globalMax - globalMin;
@@ -36,11 +28,16 @@ QImage toQImage(const Mat &mat)
         mat8u = mat;
     }
 
-    // Convert to 3 channels
-    Mat mat8uc3;
-    if      (mat8u.channels() == 4) cvtColor(mat8u, mat8uc3, CV_BGRA2RGB);
-    else if (mat8u.channels() == 3) cvtColor(mat8u, mat8uc3, CV_BGR2RGB);
-    else if (mat8u.channels() == 1) cvtColor(mat8u, mat8uc3, CV_GRAY2RGB);
+    // Only gray, BGR and BGRA matrices can be displayed
+    const int channels = mat8u.channels();
+    if ((channels != 1) && (channels != 3) && (channels != 4)) return QImage();
+
+    // Convert to 3 channels directly into the image's buffer
+    QImage image(mat8u.cols, mat8u.rows, QImage::Format_RGB888);
+    Mat mat8uc3(image.height(), image.width(), CV_8UC3, image.bits(), image.bytesPerLine());
+    if      (channels == 4) cvtColor(mat8u, mat8uc3, CV_BGRA2RGB);
+    else if (channels == 3) cvtColor(mat8u, mat8uc3, CV_BGR2RGB);
+    else                    cvtColor(mat8u, mat8uc3, CV_GRAY2RGB);
 
-    return QImage(mat8uc3.data, mat8uc3.cols, mat8uc3.rows, 3*mat8uc3.cols, QImage::Format_RGB888).copy();
+    return image;
 }
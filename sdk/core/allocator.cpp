@@ -0,0 +1,182 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <QtGlobal>
+
+#include "allocator.h"
+
+using namespace cv;
+
+static const int MaxCached = 32; // Per thread and size class
+static const size_t MaxThreadBytes = 16 << 20; // Per thread, across size classes
+static const size_t MaxSharedBytes = 128 << 20; // Shared pool, across size classes
+static const size_t HeaderSize = 16; // Keeps matrix data 16 byte aligned
+
+PooledAllocator *PooledAllocator::instance()
+{
+    // Intentionally leaked, matrices may be released during static destruction
+    static PooledAllocator *allocator = new PooledAllocator();
+    return allocator;
+}
+
+PooledAllocator::PooledAllocator()
+    : sharedBytes(0)
+{
+    Q_ASSERT(sizeof(Block) <= HeaderSize);
+    for (int i=0; i<NumClasses; i++)
+        capacities[i] = (i % 2 == 0) ? (size_t(64) << (i/2)) : (size_t(96) << (i/2));
+    caches = new QThreadStorage<ThreadCache*>();
+}
+
+PooledAllocator::ThreadCache::~ThreadCache()
+{
+    // The thread is exiting, hand its blocks to the shared pool
+    PooledAllocator *allocator = PooledAllocator::instance();
+    for (int i=0; i<NumClasses; i++)
+        while (lists[i].count > 0)
+            allocator->release(lists[i].pop());
+    bytes = 0;
+}
+
+PooledAllocator::ThreadCache *PooledAllocator::cache()
+{
+    if (!caches->hasLocalData()) caches->setLocalData(new ThreadCache());
+    return caches->localData();
+}
+
+int PooledAllocator::sizeClass(size_t size) const
+{
+    for (int i=0; i<NumClasses; i++)
+        if (size <= capacities[i]) return i;
+    return -1;
+}
+
+// Called with sharedLock held, moves at most count blocks from the shared pool without exceeding the thread's budget
+void PooledAllocator::refill(ThreadCache *cache, int c, int count)
+{
+    FreeList &from = shared[c];
+    while ((count-- > 0) && (from.count > 0) && (cache->bytes + capacities[c] <= MaxThreadBytes)) {
+        cache->lists[c].push(from.pop());
+        cache->bytes += capacities[c];
+        sharedBytes -= capacities[c];
+    }
+}
+
+void PooledAllocator::release(Block *block)
+{
+    const int c = block->sizeClass;
+    if (c >= 0) {
+        QMutexLocker locker(&sharedLock);
+        if (sharedBytes + capacities[c] <= MaxSharedBytes) {
+            shared[c].push(block);
+            sharedBytes += capacities[c];
+            return;
+        }
+    }
+
+    fastFree(block);
+    frees.ref();
+}
+
+void PooledAllocator::allocate(int dims, const int *sizes, int type, int *&refcount, uchar *&datastart, uchar *&data, size_t *step)
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i=dims-1; i>=0; i--) {
+        if (step) step[i] = total;
+        total *= sizes[i];
+    }
+
+    const int c = sizeClass(total);
+    Block *block = NULL;
+    if (c >= 0) {
+        ThreadCache *cache = this->cache();
+        FreeList &list = cache->lists[c];
+        if (list.count == 0) {
+            QMutexLocker locker(&sharedLock);
+            refill(cache, c, MaxCached/2);
+        }
+        if (list.count > 0) {
+            block = list.pop();
+            cache->bytes -= capacities[c];
+        }
+    }
+
+    if (block == NULL) {
+        block = (Block*) fastMalloc(HeaderSize + (c >= 0 ? capacities[c] : total));
+        block->sizeClass = c;
+        mallocs.ref();
+    }
+    allocations.ref();
+
+    block->refcount = 1;
+    refcount = &block->refcount;
+    datastart = data = (uchar*)block + HeaderSize;
+}
+
+void PooledAllocator::deallocate(int *refcount, uchar *datastart, uchar *data)
+{
+    (void) data;
+    if (!refcount) return;
+    Block *block = (Block*)(datastart - HeaderSize);
+    const int c = block->sizeClass;
+    if (c < 0) {
+        fastFree(block);
+        frees.ref();
+        return;
+    }
+
+    // Over budget blocks go to the shared pool, which frees them once it is over its own budget
+    ThreadCache *cache = this->cache();
+    FreeList &list = cache->lists[c];
+    if ((list.count >= MaxCached) || (cache->bytes + capacities[c] > MaxThreadBytes)) {
+        release(block);
+        return;
+    }
+    list.push(block);
+    cache->bytes += capacities[c];
+}
+
+PooledAllocator::Statistics PooledAllocator::statistics() const
+{
+    Statistics statistics;
+    statistics.allocations = allocations;
+    statistics.mallocs = mallocs;
+    statistics.frees = frees;
+    return statistics;
+}
+
+void PooledAllocator::resetStatistics()
+{
+    allocations = 0;
+    mallocs = 0;
+    frees = 0;
+}
+
+MatAllocator *PooledAllocator::current() const
+{
+    if (!caches->hasLocalData()) return NULL;
+    return caches->localData()->depth > 0 ? const_cast<PooledAllocator*>(this) : NULL;
+}
+
+void PooledAllocator::install()
+{
+    cache()->depth++;
+}
+
+void PooledAllocator::uninstall()
+{
+    cache()->depth--;
+}
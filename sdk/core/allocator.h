@@ -0,0 +1,98 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __ALLOCATOR_H
+#define __ALLOCATOR_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThreadStorage>
+#include <opencv2/core/core.hpp>
+
+/*!
+ * \brief Size-class based matrix allocator with per-thread free lists.
+ *
+ * Blocks released by a thread are cached by that thread and handed back out on the next allocation of the same size class.
+ * Threads with too many cached blocks return some to a shared pool, and threads with none refill from it,
+ * so matrices allocated by a worker and released by the main thread are still recycled.
+ * Each thread caches at most 16 MB and the shared pool at most 128 MB, blocks beyond that go back to the system allocator.
+ * Allocations larger than the biggest size class bypass the pool.
+ */
+class PooledAllocator : public cv::MatAllocator
+{
+public:
+    struct Statistics
+    {
+        int allocations; /*!< \brief Matrices allocated through the pool. */
+        int mallocs; /*!< \brief Allocations that had to go to the system allocator. */
+        int frees; /*!< \brief Blocks returned to the system allocator. */
+    };
+
+    static PooledAllocator *instance(); /*!< \brief The process-wide allocator, never destroyed. */
+
+    void allocate(int dims, const int *sizes, int type, int *&refcount, uchar *&datastart, uchar *&data, size_t *step);
+    void deallocate(int *refcount, uchar *datastart, uchar *data);
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+    cv::MatAllocator *current() const; /*!< \brief The allocator installed on the calling thread, or \c NULL. */
+    void install(); /*!< \brief Installs the pool on the calling thread, calls may nest. */
+    void uninstall(); /*!< \brief Reverses one install(). */
+
+private:
+    enum { NumClasses = 37 }; // 64 bytes to 16 MB in half powers of two
+
+    struct Block
+    {
+        int refcount;
+        int sizeClass;
+        Block *next;
+    };
+
+    struct FreeList
+    {
+        Block *head;
+        int count;
+        FreeList() : head(NULL), count(0) {}
+        void push(Block *block) { block->next = head; head = block; count++; }
+        Block *pop() { Block *block = head; head = block->next; count--; return block; }
+    };
+
+    struct ThreadCache
+    {
+        FreeList lists[NumClasses];
+        size_t bytes;
+        int depth;
+        ThreadCache() : bytes(0), depth(0) {}
+        ~ThreadCache();
+    };
+
+    size_t capacities[NumClasses];
+    FreeList shared[NumClasses];
+    size_t sharedBytes;
+    mutable QMutex sharedLock;
+    QThreadStorage<ThreadCache*> *caches; // Heap allocated so the main thread's cache outlives static destruction
+    QAtomicInt allocations, mallocs, frees;
+
+    PooledAllocator();
+    ThreadCache *cache();
+    int sizeClass(size_t size) const;
+    void release(Block *block);
+    void refill(ThreadCache *cache, int c, int count);
+};
+
+#endif // __ALLOCATOR_H
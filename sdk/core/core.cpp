@@ -14,13 +14,48 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <QMutex>
+#include <QPair>
+#include <QtAlgorithms>
+#include <limits>
 #include <openbr_plugin.h>
 
+#include "core/allocator.h"
 #include "core/common.h"
+#include "core/model.h"
 #include "core/qtutils.h"
 
 using namespace br;
 
+/**** SAMPLE_OUTPUT ****/
+// Forwards the scores of a sample of a target block to the output and keeps the highest, used to rank target blocks
+class SampleOutput : public Output
+{
+    Output *output;
+    QList<int> columns; // Index in the target block of each sampled target
+    float best;
+    QMutex bestLock;
+
+    void set(float value, int i, int j)
+    {
+        output->setRelative(value, i, columns[j]);
+        QMutexLocker locker(&bestLock);
+        best = std::max(best, value);
+    }
+
+public:
+    SampleOutput(Output *output, const QList<int> &columns, const FileList &targetFiles, const FileList &queryFiles)
+        : output(output), columns(columns), best(-std::numeric_limits<float>::max())
+    {
+        initialize(targetFiles, queryFiles);
+    }
+
+    float score() const
+    {
+        return best;
+    }
+};
+
 /**** ALGORITHM_CORE ****/
 struct AlgorithmCore
 {
@@ -40,6 +75,11 @@ struct AlgorithmCore
 
     void train(const QString &inputs, const QString &model)
     {
+        if (Globals->streamTraining) {
+            streamTrain(inputs, model);
+            return;
+        }
+
         TemplateList data(TemplateList::fromInput(inputs));
 
         if (transform.isNull()) qFatal("AlgorithmCore::train null transform.");
@@ -65,39 +105,84 @@ struct AlgorithmCore
         qDebug("Training Time (sec): %d", time.elapsed()/1000);
     }
 
+    // Trains the transform without holding the input in memory, only the projected templates are kept for the distance
+    void streamTrain(const QString &inputs, const QString &model)
+    {
+        if (transform.isNull()) qFatal("AlgorithmCore::train null transform.");
+        QScopedPointer<TemplateSource> source(TemplateSource::fromInput(inputs));
+
+        QTime time; time.start();
+        qDebug("Training Enrollment");
+        transform->streamTrain(*source);
+
+        if (!distance.isNull()) {
+            qDebug("Projecting Enrollment");
+            TemplateList data;
+            TemplateList block;
+            source->rewind();
+            while (source->read(block))
+                data.append((*transform)(block));
+
+            qDebug("Training Comparison");
+            distance->train(data);
+        }
+
+        if (!model.isEmpty()) {
+            qDebug("Storing %s", qPrintable(QFileInfo(model).fileName()));
+            store(model);
+        }
+
+        qDebug("Training Time (sec): %d", time.elapsed()/1000);
+    }
+
     void store(const QString &model) const
     {
-        // Create stream
-        QByteArray data;
-        QDataStream out(&data, QFile::WriteOnly);
+        // Serialize each component of the algorithm to its own section
+        QByteArray header, transformData, distanceData;
+        QDataStream headerStream(&header, QFile::WriteOnly);
+        QDataStream transformStream(&transformData, QFile::WriteOnly);
+        QDataStream distanceStream(&distanceData, QFile::WriteOnly);
 
-        // Serialize algorithm to stream
-        out << name;
-        transform->store(out);
         const bool hasComparer = !distance.isNull();
-        out << hasComparer;
-        if (hasComparer) distance->store(out);
-        out << Globals->classes;
-
-        // Compress and save to file
-        QtUtils::writeFile(model, data);
+        headerStream << name << hasComparer << Globals->classes;
+        transform->store(transformStream);
+        if (hasComparer) distance->store(distanceStream);
+
+        // Save uncompressed so the model can be memory mapped
+        QList<ModelFile::Section> sections;
+        sections.append(ModelFile::Section("algorithm", header));
+        sections.append(ModelFile::Section("transform", transformData));
+        if (hasComparer) sections.append(ModelFile::Section("distance", distanceData));
+        ModelFile::write(model, sections);
     }
 
     void load(const QString &model)
     {
-        // Load from file and decompress
-        QByteArray data;
-        QtUtils::readFile(model, data);
-
-        // Create stream
-        QDataStream in(&data, QFile::ReadOnly);
-
-        // Load algorithm
-        in >> name; init(Globals->abbreviations.contains(name) ? Globals->abbreviations[name] : name);
-        transform->load(in);
-        bool hasDistance; in >> hasDistance;
-        if (hasDistance) distance->load(in);
-        in >> Globals->classes;
+        ModelFile modelFile(model);
+
+        if (!modelFile.isSectioned()) {
+            // Legacy single compressed stream
+            QDataStream in(modelFile.section(""));
+            in >> name; init(Globals->abbreviations.contains(name) ? Globals->abbreviations[name] : name);
+            transform->load(in);
+            bool hasDistance; in >> hasDistance;
+            if (hasDistance) distance->load(in);
+            in >> Globals->classes;
+            return;
+        }
+
+        bool hasDistance;
+        QDataStream headerStream(modelFile.section("algorithm"));
+        headerStream >> name >> hasDistance >> Globals->classes;
+        init(Globals->abbreviations.contains(name) ? Globals->abbreviations[name] : name);
+
+        // Sections are deserialized straight from the mapped file, each transform copies what it needs
+        QDataStream transformStream(modelFile.section("transform"));
+        transform->load(transformStream);
+        if (hasDistance) {
+            QDataStream distanceStream(modelFile.section("distance"));
+            distance->load(distanceStream);
+        }
     }
 
     File getMemoryGallery(const File &file) const
@@ -122,6 +207,7 @@ struct AlgorithmCore
         Globals->currentStep = 0;
         Globals->totalSteps = i.size();
         Globals->startTime.start();
+        PooledAllocator::instance()->resetStatistics();
 
         const int subBlockSize = 4*std::max(1, Globals->parallelism);
         const int numSubBlocks = ceil(1.0*Globals->blockSize/subBlockSize);
@@ -150,6 +236,11 @@ struct AlgorithmCore
         if (!Globals->quiet && (Globals->totalSteps > 1))
             fprintf(stderr, "\rSPEED=%.1e  SIZE=%.4g  FAILURES=%d/%d  \n",
                     speed, totalBytes/totalCount, failureCount, totalCount);
+        if (Globals->verbose && Globals->poolMatrices) {
+            const PooledAllocator::Statistics statistics = PooledAllocator::instance()->statistics();
+            fprintf(stderr, "ALLOCATIONS=%d  MALLOCS=%d  FREES=%d\n",
+                    statistics.allocations, statistics.mallocs, statistics.frees);
+        }
         Globals->totalSteps = 0;
 
         return fileList;
@@ -184,15 +275,20 @@ struct AlgorithmCore
         Globals->totalSteps = double(targetFiles.size()) * double(queryFiles.size());
         Globals->startTime.start();
 
+        // The output's prefilter argument overrides the global one for this comparison
+        const int prefilter = output.getInt("prefilter", Globals->prefilter);
+
         int queryBlock = -1;
         bool queryDone = false;
-        while (!queryDone) {
+        while (!queryDone && !o->cancelled()) {
             queryBlock++;
             TemplateList queries = q->readBlock(&queryDone);
+            if ((prefilter > 0) && comparePrioritized(t.data(), queries, queryBlock, o.data(), prefilter))
+                continue;
 
             int targetBlock = -1;
             bool targetDone = false;
-            while (!targetDone) {
+            while (!targetDone && !o->cancelled()) {
                 targetBlock++;
                 TemplateList targets = t->readBlock(&targetDone);
 
@@ -212,6 +308,61 @@ struct AlgorithmCore
 private:
     QString name;
 
+    // Compares the target blocks in order of their best score against every prefilter-th target of each, returning false if the gallery can't seek.
+    // The sampled scores are written as they are found, and the remaining targets of each block are compared afterwards.
+    bool comparePrioritized(Gallery *t, const TemplateList &queries, int queryBlock, Output *o, int prefilter)
+    {
+        const qint64 start = t->position();
+        if (start < 0) return false;
+
+        typedef QPair<float,int> Priority; // QPair<Best sampled score, Block>
+        QList<Priority> priorities;
+        QList<qint64> positions;
+        bool done = false;
+        while (!done && !o->cancelled()) {
+            positions.append(t->position());
+            const TemplateList targets = t->readBlock(&done);
+
+            TemplateList sample;
+            QList<int> columns;
+            for (int j=0; j<targets.size(); j+=prefilter) {
+                sample.append(targets[j]);
+                columns.append(j);
+            }
+            o->setBlock(queryBlock, priorities.size());
+            SampleOutput sampleOutput(o, columns, sample.files(), queries.files());
+            distance->compare(sample, queries, &sampleOutput);
+            priorities.append(Priority(sampleOutput.score(), priorities.size()));
+
+            Globals->currentStep += double(sample.size()) * double(queries.size());
+            Globals->printStatus();
+        }
+        qSort(priorities.begin(), priorities.end(), qGreater<Priority>());
+
+        foreach (const Priority &priority, priorities) {
+            if (o->cancelled()) break;
+            t->seek(positions[priority.second]);
+            const TemplateList targets = t->readBlock(&done);
+
+            TemplateList rest;
+            QList<int> columns;
+            for (int j=0; j<targets.size(); j++) {
+                if (j % prefilter == 0) continue;
+                rest.append(targets[j]);
+                columns.append(j);
+            }
+            o->setBlock(queryBlock, priority.second);
+            SampleOutput restOutput(o, columns, rest.files(), queries.files());
+            distance->compare(rest, queries, &restOutput);
+
+            Globals->currentStep += double(rest.size()) * double(queries.size());
+            Globals->printStatus();
+        }
+
+        t->seek(start);
+        return true;
+    }
+
     QString getFileName(const QString &description) const
     {
         const QString file = Globals->sdkPath + "/share/openbr/models/algorithms/" + description;
@@ -262,14 +413,11 @@ public:
     {
         if (algorithm.isEmpty()) qFatal("AlgorithmManager::getAlgorithm no default algorithm set.");
 
-        if (!algorithms.contains(algorithm)) {
-            algorithmsLock.lock();
-            if (!algorithms.contains(algorithm))
-                algorithms.insert(algorithm, QSharedPointer<AlgorithmCore>(new AlgorithmCore(algorithm)));
-            algorithmsLock.unlock();
-        }
-
-        return algorithms[algorithm];
+        // Hold the lock for lookups too, concurrent callers of the C API may be inserting
+        QMutexLocker locker(&algorithmsLock);
+        if (!algorithms.contains(algorithm))
+            algorithms.insert(algorithm, QSharedPointer<AlgorithmCore>(new AlgorithmCore(algorithm)));
+        return algorithms.value(algorithm);
     }
 };
 
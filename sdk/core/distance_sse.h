@@ -48,6 +48,23 @@ inline float l1(const uchar *a, const uchar *b, int size)
     return buff[0] + buff[1];
 }
 
+inline float unaligned_l1(const uchar *a, const uchar *b, int size)
+{
+    size = size / sizeof(__m128i);
+    __m128i accumulate = _mm_setzero_si128();
+
+    for (int i=0; i<size; i++) {
+        __m128i A = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a)+i);
+        __m128i B = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)+i);
+        __m128i sad = _mm_sad_epu8(A, B);
+        accumulate = _mm_add_epi64(sad, accumulate);
+    }
+
+    int64_t buff[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&buff), accumulate);
+    return buff[0] + buff[1];
+}
+
 #else
 
 inline float l1(const uchar *a, const uchar *b, int size)
@@ -58,6 +75,11 @@ inline float l1(const uchar *a, const uchar *b, int size)
     return distance;
 }
 
+inline float unaligned_l1(const uchar *a, const uchar *b, int size)
+{
+    return l1(a, b, size);
+}
+
 #endif
 
 inline float packed_l1(const uchar *a, const uchar *b, int size)
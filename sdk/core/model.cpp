@@ -0,0 +1,130 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <QDataStream>
+#include <cstring>
+#include <limits>
+
+#include "model.h"
+#include "qtutils.h"
+
+static const char ModelMagic[8] = { 'B', 'R', 'M', 'O', 'D', 'E', 'L', '\0' };
+static const quint32 ModelVersion = 1;
+static const qint64 ModelAlignment = 4096;
+
+static qint64 align(qint64 offset)
+{
+    return (offset + ModelAlignment - 1) / ModelAlignment * ModelAlignment;
+}
+
+static QByteArray tableOfContents(const QList<ModelFile::Section> &sections, qint64 dataOffset)
+{
+    QByteArray toc;
+    QDataStream stream(&toc, QFile::WriteOnly);
+    stream.writeRawData(ModelMagic, sizeof(ModelMagic));
+    stream << ModelVersion << quint32(sections.size());
+
+    qint64 offset = dataOffset;
+    foreach (const ModelFile::Section &section, sections) {
+        stream << section.first << offset << qint64(section.second.size());
+        offset = align(offset + section.second.size());
+    }
+    return toc;
+}
+
+ModelFile::ModelFile(const QString &fileName)
+    : file(fileName), mapping(NULL)
+{
+    if (!file.open(QFile::ReadOnly)) qFatal("ModelFile::ModelFile unable to open %s for reading.", qPrintable(fileName));
+
+    char magic[sizeof(ModelMagic)];
+    if ((file.read(magic, sizeof(magic)) != sizeof(magic)) || memcmp(magic, ModelMagic, sizeof(magic))) {
+        // Legacy format
+        file.close();
+        QtUtils::readFile(fileName, legacy);
+        sections.insert("", QPair<qint64,qint64>(0, legacy.size()));
+        return;
+    }
+
+    mapping = file.map(0, file.size());
+    if (mapping == NULL) qFatal("ModelFile::ModelFile unable to map %s.", qPrintable(fileName));
+
+    QDataStream stream(QByteArray::fromRawData(reinterpret_cast<const char*>(mapping), file.size()));
+    stream.skipRawData(sizeof(ModelMagic));
+    quint32 version, count;
+    stream >> version >> count;
+    if (version != ModelVersion) qFatal("ModelFile::ModelFile unsupported version %d in %s.", version, qPrintable(fileName));
+
+    for (quint32 i=0; i<count; i++) {
+        QString name;
+        qint64 offset, size;
+        stream >> name >> offset >> size;
+        // Written as (size > file.size() - offset) so a corrupt entry can't overflow the bounds check
+        if ((stream.status() != QDataStream::Ok) || (offset < 0) || (size < 0) ||
+            (offset > file.size()) || (size > file.size() - offset) || (size > std::numeric_limits<int>::max()))
+            qFatal("ModelFile::ModelFile corrupt table of contents in %s.", qPrintable(fileName));
+        sections.insert(name, QPair<qint64,qint64>(offset, size));
+    }
+}
+
+ModelFile::~ModelFile()
+{
+    if (mapping != NULL) file.unmap(mapping);
+    file.close();
+}
+
+bool ModelFile::isSectioned() const
+{
+    return mapping != NULL;
+}
+
+bool ModelFile::contains(const QString &name) const
+{
+    return sections.contains(name);
+}
+
+QStringList ModelFile::names() const
+{
+    return sections.keys();
+}
+
+QByteArray ModelFile::section(const QString &name) const
+{
+    if (!sections.contains(name)) qFatal("ModelFile::section missing section %s in %s.", qPrintable(name), qPrintable(file.fileName()));
+    if (!isSectioned()) return legacy;
+
+    const QPair<qint64,qint64> &location = sections[name];
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(mapping + location.first), location.second);
+}
+
+void ModelFile::write(const QString &fileName, const QList<Section> &sections)
+{
+    // The table of contents has a fixed size for a given list of section names
+    const qint64 dataOffset = align(tableOfContents(sections, 0).size());
+
+    QFile f(fileName);
+    QtUtils::touchDir(f);
+    if (!f.open(QFile::WriteOnly)) qFatal("ModelFile::write failed to open %s for writing.", qPrintable(fileName));
+    f.write(tableOfContents(sections, dataOffset));
+
+    qint64 offset = dataOffset;
+    foreach (const Section &section, sections) {
+        f.seek(offset);
+        f.write(section.second);
+        offset = align(offset + section.second.size());
+    }
+    f.close();
+}
@@ -0,0 +1,59 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2012 The MITRE Corporation                                      *
+ *                                                                           *
+ * Licensed under the Apache License, Version 2.0 (the "License");           *
+ * you may not use this file except in compliance with the License.          *
+ * You may obtain a copy of the License at                                   *
+ *                                                                           *
+ *     http://www.apache.org/licenses/LICENSE-2.0                            *
+ *                                                                           *
+ * Unless required by applicable law or agreed to in writing, software       *
+ * distributed under the License is distributed on an "AS IS" BASIS,         *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+ * See the License for the specific language governing permissions and       *
+ * limitations under the License.                                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __MODEL_H
+#define __MODEL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+
+/*!
+ * \brief Uncompressed, sectioned container for trained models.
+ *
+ * A model file starts with a small table of contents followed by named sections.
+ * Each section is stored raw and page aligned so the file can be memory mapped,
+ * and loading deserializes straight from the mapping instead of reading and inflating a compressed copy.
+ * Transforms still copy their parameters into their own memory in br::Object::load(),
+ * so the mapping only lives while the model is loaded and loaded parameters are not shared between processes.
+ * Files written by older versions (a single qCompress'ed stream) are still readable as one section named \c "".
+ */
+class ModelFile
+{
+    QFile file;
+    uchar *mapping;
+    QByteArray legacy;
+    QHash< QString, QPair<qint64,qint64> > sections; // QHash<Name, QPair<Offset,Size> >
+
+public:
+    typedef QPair<QString,QByteArray> Section;
+
+    ModelFile(const QString &fileName);
+    ~ModelFile();
+
+    bool isSectioned() const; /*!< \brief \c true if the file is a sectioned model, \c false if it uses the legacy compressed format. */
+    bool contains(const QString &name) const;
+    QStringList names() const;
+    QByteArray section(const QString &name) const; /*!< \brief Returns a view of the section without copying, valid for the lifetime of the ModelFile. */
+
+    static void write(const QString &fileName, const QList<Section> &sections);
+};
+
+#endif // __MODEL_H
@@ -93,4 +93,33 @@ public:
     }
 };
 
+/*!
+ * \brief Process-wide cache of read-only objects, typically models loaded from disk.
+ *
+ * Objects are constructed once per key by the supplied ResourceMaker and shared by reference thereafter.
+ * Keys should include the model path and any parameters that affect how it is loaded.
+ * Shared objects must not be modified, per-thread scratch data belongs in the caller or a Resource.
+ */
+template <typename T>
+class ResourceRegistry
+{
+    static QHash< QString, QSharedPointer<T> > resources;
+    static QMutex lock;
+
+public:
+    static QSharedPointer<const T> get(const QString &key, const ResourceMaker<T> &maker)
+    {
+        QMutexLocker locker(&lock);
+        QSharedPointer<T> resource = resources.value(key);
+        if (resource.isNull()) {
+            resource = QSharedPointer<T>(maker.make());
+            resources.insert(key, resource);
+        }
+        return resource;
+    }
+};
+
+template <typename T> QHash< QString, QSharedPointer<T> > ResourceRegistry<T>::resources;
+template <typename T> QMutex ResourceRegistry<T>::lock;
+
 #endif //__RESOURCE_H
@@ -26,6 +26,35 @@ static QSharedPointer<Transform> frvt2012_transform;
 static QSharedPointer<Transform> frvt2012_age_transform;
 static QSharedPointer<Transform> frvt2012_gender_transform;
 static const int frvt2012_template_size = 768;
+static const uint32_t frvt2012_template_magic = 0x42524654; // "BRFT"
+static const uint16_t frvt2012_template_version = 1;
+
+/*!
+ * \brief Fixed binary header preceding the feature vectors of a proprietary template.
+ *
+ * The header is 16 bytes so that feature vectors, each a multiple of 16 bytes, stay 16-byte aligned relative to the start of the template.
+ * A template with zero \c count encodes a failure to enroll.
+ */
+struct FRVT2012TemplateHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t featureSize;
+    uint32_t reserved;
+};
+
+static const FRVT2012TemplateHeader *readHeader(const uint8_t *proprietary_template, uint32_t template_size)
+{
+    if (template_size < sizeof(FRVT2012TemplateHeader)) return NULL;
+    const FRVT2012TemplateHeader *header = reinterpret_cast<const FRVT2012TemplateHeader*>(proprietary_template);
+    if ((header->magic != frvt2012_template_magic) ||
+        (header->version != frvt2012_template_version) ||
+        (header->featureSize != (uint32_t)frvt2012_template_size) ||
+        (template_size < sizeof(FRVT2012TemplateHeader) + header->count * header->featureSize))
+        return NULL;
+    return header;
+}
 
 static void initialize(const string &configuration_location)
 {
@@ -49,8 +78,9 @@ int32_t get_pid(string &sdk_identifier, string &email_address)
 
 int32_t get_max_template_sizes(uint32_t &max_enrollment_template_size, uint32_t &max_recognition_template_size)
 {
-    max_enrollment_template_size = frvt2012_template_size;
-    max_recognition_template_size = frvt2012_template_size;
+    // NIST allocates this size per input image and the header is only written once
+    max_enrollment_template_size = sizeof(FRVT2012TemplateHeader) + frvt2012_template_size;
+    max_recognition_template_size = sizeof(FRVT2012TemplateHeader) + frvt2012_template_size;
     return 0;
 }
 
@@ -76,32 +106,56 @@ int32_t convert_multiface_to_verification_template(const MULTIFACE &input_faces,
         templates.append(templateFromONEFACE(oneface));
     templates >> *frvt2012_transform.data();
 
-    // Compute template size
-    template_size = templates.size() * frvt2012_template_size;
-
-    // Create proprietary template
-    for (int i=0; i<templates.size(); i++)
-        memcpy(&proprietary_template[i*frvt2012_template_size], templates[i].m().data, frvt2012_template_size);
+    // Create proprietary template, skipping faces that failed to enroll
+    FRVT2012TemplateHeader header;
+    header.magic = frvt2012_template_magic;
+    header.version = frvt2012_template_version;
+    header.count = 0;
+    header.featureSize = frvt2012_template_size;
+    header.reserved = 0;
+
+    uint8_t *features = proprietary_template + sizeof(FRVT2012TemplateHeader);
+    foreach (const Template &t, templates) {
+        if (t.file.failed() || t.isEmpty()) continue;
+        const cv::Mat &m = t;
+        if (!m.isContinuous() || (m.total() * m.elemSize() != (size_t)frvt2012_template_size)) continue;
+        memcpy(&features[header.count * frvt2012_template_size], m.data, frvt2012_template_size);
+        header.count++;
+    }
+    memcpy(proprietary_template, &header, sizeof(FRVT2012TemplateHeader));
+    template_size = sizeof(FRVT2012TemplateHeader) + header.count * frvt2012_template_size;
 
-    quality = 100;
-    return 0;
+    quality = (header.count == 0) ? 255 : 100;
+    return (header.count == 0) ? 4 : 0;
 }
 
 int32_t match_templates(const uint8_t* verification_template, const uint32_t verification_template_size, const uint8_t* enrollment_template, const uint32_t enrollment_template_size, double &similarity)
 {
-    const int num_verification = verification_template_size / frvt2012_template_size;
-    const int num_enrollment = enrollment_template_size / frvt2012_template_size;
+    const FRVT2012TemplateHeader *verification_header = readHeader(verification_template, verification_template_size);
+    const FRVT2012TemplateHeader *enrollment_header = readHeader(enrollment_template, enrollment_template_size);
 
     // Return early for failed templates
-    if ((num_verification == 0) || (num_enrollment == 0)) {
+    if ((verification_header == NULL) || (enrollment_header == NULL) ||
+        (verification_header->count == 0) || (enrollment_header->count == 0)) {
         similarity = -1;
         return 2;
     }
 
+    const int num_verification = verification_header->count;
+    const int num_enrollment = enrollment_header->count;
+    const uint8_t *verification_features = verification_template + sizeof(FRVT2012TemplateHeader);
+    const uint8_t *enrollment_features = enrollment_template + sizeof(FRVT2012TemplateHeader);
+
+    // The harness makes no alignment guarantees about the buffers it passes in
+    const bool aligned = ((reinterpret_cast<size_t>(verification_features) | reinterpret_cast<size_t>(enrollment_features)) % 16) == 0;
+
     similarity = 0;
     for (int i=0; i<num_verification; i++)
-        for (int j=0; j<num_enrollment; j++)
-            similarity += l1(&verification_template[i*frvt2012_template_size], &enrollment_template[j*frvt2012_template_size], frvt2012_template_size);
+        for (int j=0; j<num_enrollment; j++) {
+            const uint8_t *a = &verification_features[i*frvt2012_template_size];
+            const uint8_t *b = &enrollment_features[j*frvt2012_template_size];
+            similarity += aligned ? l1(a, b, frvt2012_template_size) : unaligned_l1(a, b, frvt2012_template_size);
+        }
     similarity /= num_verification * num_enrollment;
     similarity = std::max(0.0, -0.00112956 * (similarity - 6389.75)); // Yes this is a hard coded hack taken from FaceRecognition score normalization
     return 0;
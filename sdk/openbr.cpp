@@ -14,6 +14,8 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <opencv2/highgui/highgui.hpp>
+#include <limits>
 #include <openbr_plugin.h>
 
 #include "core/bee.h"
@@ -25,6 +27,39 @@
 
 using namespace br;
 
+static QString algorithmOrDefault(const char *algorithm)
+{
+    return ((algorithm == NULL) || (algorithm[0] == '\0')) ? Globals->algorithm : QString(algorithm);
+}
+
+// A template with no matrices and the given failure flag
+static br_template failedTemplate(const QString &flag)
+{
+    Template *dst = new Template();
+    dst->file.setBool(flag);
+    return dst;
+}
+
+static br_template enrollMat(const cv::Mat &m, const char *algorithm)
+{
+    Template *dst = new Template();
+    Template src(File(), m);
+    if (!m.data) {
+        dst->file.setBool("FTO");
+        return dst;
+    }
+
+    QSharedPointer<Transform> transform = Transform::fromAlgorithm(algorithmOrDefault(algorithm));
+    try {
+        transform->project(src, *dst);
+    } catch (...) {
+        qWarning("Exception triggered when enrolling template from memory with algorithm %s", qPrintable(algorithmOrDefault(algorithm)));
+        *dst = Template(src.file);
+        dst->file.setBool("FTE");
+    }
+    return dst;
+}
+
 const char *br_about()
 {
     static QByteArray about = Context::about().toLocal8Bit();
@@ -46,6 +81,26 @@ void br_compare(const char *target_gallery, const char *query_gallery, const cha
     Compare(File(target_gallery), File(query_gallery), File(output));
 }
 
+void br_compare_templates(br_template probe, int num_targets, const br_template targets[], float *scores, const char *algorithm)
+{
+    QSharedPointer<Distance> distance = Distance::fromAlgorithm(algorithmOrDefault(algorithm));
+    if (distance.isNull()) qFatal("br_compare_templates null distance.");
+
+    // Templates that failed to enroll can't be compared, they get the lowest possible score
+    const Template &query = *static_cast<const Template*>(probe);
+    const bool queryFailed = query.file.failed() || query.isEmpty();
+    for (int i=0; i<num_targets; i++) {
+        const Template &target = *static_cast<const Template*>(targets[i]);
+        scores[i] = -std::numeric_limits<float>::max();
+        if (queryFailed || target.file.failed() || target.isEmpty()) continue;
+        try {
+            scores[i] = distance->compare(target, query);
+        } catch (...) {
+            qWarning("Exception triggered when comparing templates with algorithm %s", qPrintable(algorithmOrDefault(algorithm)));
+        }
+    }
+}
+
 void br_confusion(const char *file, float score, int *true_positives, int *false_positives, int *true_negatives, int *false_negatives)
 {
     return Confusion(file, score, *true_positives, *false_positives, *true_negatives, *false_negatives);
@@ -64,6 +119,19 @@ void br_convert(const char *input_matrix, const char *output_matrix)
     }
 }
 
+br_template br_deserialize_template(const unsigned char *data, int size)
+{
+    const QByteArray byteArray = QByteArray::fromRawData(reinterpret_cast<const char*>(data), size);
+    QDataStream stream(byteArray);
+    Template *t = new Template();
+    stream >> *t;
+    if (stream.status() != QDataStream::Ok) {
+        delete t;
+        return NULL;
+    }
+    return t;
+}
+
 void br_enroll(const char *input, const char *gallery)
 {
     Enroll(File(input), File(gallery));
@@ -75,6 +143,30 @@ void br_enroll_n(int num_inputs, const char *inputs[], const char *gallery)
     else                Enroll(File(inputs[0]), gallery);
 }
 
+br_template br_enroll_buffer(const unsigned char *data, int size, const char *algorithm)
+{
+    if ((data == NULL) || (size <= 0)) return failedTemplate("FTO");
+
+    cv::Mat m;
+    try {
+        m = cv::imdecode(cv::Mat(1, size, CV_8UC1, const_cast<unsigned char*>(data)), 1);
+    } catch (...) {
+        qWarning("Exception triggered when decoding a %d byte buffer", size);
+        return failedTemplate("FTE");
+    }
+    return enrollMat(m, algorithm);
+}
+
+br_template br_enroll_pixels(const unsigned char *data, int rows, int columns, int channels, const char *algorithm)
+{
+    if ((channels != 1) && (channels != 3)) {
+        qWarning("br_enroll_pixels expected 1 or 3 channels, got %d.", channels);
+        return failedTemplate("FTE");
+    }
+    if ((data == NULL) || (rows <= 0) || (columns <= 0)) return failedTemplate("FTO");
+    return enrollMat(cv::Mat(rows, columns, CV_8UC(channels), const_cast<unsigned char*>(data)).clone(), algorithm);
+}
+
 float br_eval(const char *simmat, const char *mask, const char *csv)
 {
     return Evaluate(simmat, mask, csv);
@@ -100,6 +192,11 @@ void br_finalize()
     Context::finalize();
 }
 
+void br_free_template(br_template tmpl)
+{
+    delete static_cast<Template*>(tmpl);
+}
+
 void br_fuse(int num_input_simmats, const char *input_simmats[], const char *mask,
              const char *normalization, const char *fusion, const char *output_simmat)
 {
@@ -223,11 +320,26 @@ const char *br_sdk_path()
     return sdkPath.data();
 }
 
+int br_serialize_template(br_template tmpl, unsigned char *buffer, int size)
+{
+    QByteArray byteArray;
+    QDataStream stream(&byteArray, QFile::WriteOnly);
+    stream << *static_cast<const Template*>(tmpl);
+    if ((buffer != NULL) && (byteArray.size() <= size))
+        memcpy(buffer, byteArray.data(), byteArray.size());
+    return byteArray.size();
+}
+
 void br_set_property(const char *key, const char *value)
 {
     Globals->setProperty(key, value);
 }
 
+bool br_template_failed(br_template tmpl)
+{
+    return static_cast<const Template*>(tmpl)->file.failed();
+}
+
 int br_time_remaining()
 {
     return Globals->timeRemaining();
@@ -15,9 +15,12 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include <QMetaProperty>
+#include <QMutex>
 #include <QPointF>
+#include <QReadWriteLock>
 #include <QRect>
 #include <QRegExp>
+#include <QSet>
 #include <QSettings>
 #include <QThreadPool>
 #include <QtConcurrentRun>
@@ -27,13 +30,34 @@
 #include <openbr_plugin.h>
 
 #include "version.h"
+#include "core/allocator.h"
 #include "core/bee.h"
 #include "core/common.h"
+#include "core/opencvutils.h"
 #include "core/qtutils.h"
 
 using namespace br;
 using namespace cv;
 
+/* File - static data */
+static QSet<QString> InternedKeys;
+static QReadWriteLock InternedKeysLock;
+
+// Returns a shared copy of the key so that the many files carrying it don't each own a duplicate string
+static QString intern(const QString &key)
+{
+    {
+        QReadLocker locker(&InternedKeysLock);
+        QSet<QString>::const_iterator it = InternedKeys.constFind(key);
+        if (it != InternedKeys.constEnd()) return *it;
+    }
+    QWriteLocker locker(&InternedKeysLock);
+    return *InternedKeys.insert(key);
+}
+
+// Written in place of the metadata table size to identify the compact serializations
+static const quint32 TypedFileMarker = 0xFFFFFFFD; // Typed members followed by the metadata table
+
 /* File - public methods */
 QString File::flat() const
 {
@@ -71,7 +95,7 @@ void File::append(const File &other)
             name += value("separator").toString() + other.name;
         }
     }
-    append(other.m_metadata);
+    append(other.localMetadata());
 }
 
 QList<File> File::split() const
@@ -86,20 +110,81 @@ QList<File> File::split(const QString &separator) const
     QList<File> files;
     foreach (const QString &word, name.split(separator)) {
         File file(word);
-        file.append(m_metadata);
+        file.append(localMetadata());
         files.append(file);
     }
     return files;
 }
 
+QList<QString> File::localKeys() const
+{
+    QList<QString> keys = m_metadata.keys();
+    if (m_flags & HasLabel) keys.append("Label");
+    for (int i=0; i<6; i++)
+        if (m_affineSet & (1 << i)) keys.append(affineKey(i));
+    if (!m_landmarks.isEmpty()) keys.append("Landmarks");
+    if (!m_ROIs.isEmpty()) keys.append("ROIs");
+    if (m_flags & (FTE | FalseFTE)) keys.append("FTE");
+    if (m_flags & (FTO | FalseFTO)) keys.append("FTO");
+    return keys;
+}
+
+QHash<QString,QVariant> File::localMetadata() const
+{
+    QHash<QString,QVariant> metadata = m_metadata;
+    if (m_flags & HasLabel) metadata.insert("Label", m_label);
+    for (int i=0; i<6; i++)
+        if (m_affineSet & (1 << i)) metadata.insert(affineKey(i), m_affine[i]);
+    if (!m_landmarks.isEmpty()) metadata.insert("Landmarks", value("Landmarks"));
+    if (!m_ROIs.isEmpty()) metadata.insert("ROIs", value("ROIs"));
+    if      (m_flags & FTE)      metadata.insert("FTE", QVariant());
+    else if (m_flags & FalseFTE) metadata.insert("FTE", false);
+    if      (m_flags & FTO)      metadata.insert("FTO", QVariant());
+    else if (m_flags & FalseFTO) metadata.insert("FTO", false);
+    return metadata;
+}
+
 bool File::contains(const QString &key) const
 {
-    return m_metadata.contains(key) || Globals->contains(key);
+    const int slot = affineSlot(key);
+    if      (slot >= 0)          { if (m_affineSet & (1 << slot)) return true; }
+    else if (key == "Label")     { if (m_flags & HasLabel) return true; }
+    else if (key == "Landmarks") { if (!m_landmarks.isEmpty()) return true; }
+    else if (key == "ROIs")      { if (!m_ROIs.isEmpty()) return true; }
+    else if (const int f = flag(key)) { if (m_flags & (f | falseFlag(f))) return true; }
+    else if (m_metadata.contains(key)) return true;
+    return Globals->contains(key);
 }
 
 QVariant File::value(const QString &key) const
 {
-    return m_metadata.contains(key) ? m_metadata.value(key) : Globals->property(qPrintable(key));
+    const int slot = affineSlot(key);
+    if (slot >= 0) {
+        if (m_affineSet & (1 << slot)) return m_affine[slot];
+    } else if (key == "Label") {
+        if (m_flags & HasLabel) return m_label;
+    } else if (key == "Landmarks") {
+        if (!m_landmarks.isEmpty()) {
+            QList<QVariant> landmarks; landmarks.reserve(m_landmarks.size());
+            foreach (const QPointF &landmark, m_landmarks)
+                landmarks.append(landmark);
+            return landmarks;
+        }
+    } else if (key == "ROIs") {
+        if (!m_ROIs.isEmpty()) {
+            QList<QVariant> ROIs; ROIs.reserve(m_ROIs.size());
+            foreach (const QRectF &ROI, m_ROIs)
+                ROIs.append(ROI);
+            return ROIs;
+        }
+    } else if (const int f = flag(key)) {
+        if (m_flags & f) return QVariant();
+        if (m_flags & falseFlag(f)) return false;
+    } else {
+        QHash<QString,QVariant>::const_iterator it = m_metadata.constFind(key);
+        if (it != m_metadata.constEnd()) return it.value();
+    }
+    return Globals->property(qPrintable(key));
 }
 
 QString File::subject(int label)
@@ -109,9 +194,15 @@ QString File::subject(int label)
 
 float File::label() const
 {
-    const QVariant variant = value("Label");
+    const QVariant variant = (m_flags & HasLabel) ? m_label : value("Label");
     if (variant.isNull()) return -1;
 
+    switch (int(variant.type())) {
+      case QVariant::Double: return variant.toDouble();
+      case QVariant::Int:    return variant.toInt();
+      case QMetaType::Float: return variant.value<float>();
+    }
+
     if (variant.canConvert(QVariant::Double)) {
         bool ok;
         float val = variant.toFloat(&ok);
@@ -131,7 +222,8 @@ void File::set(const QString &key, const QVariant &value)
             Globals->classes.insert(value.toString(), Globals->classes.size());
     }
 
-    m_metadata.insert(key, value);
+    if (!setMember(key, value))
+        m_metadata.insert(intern(key), value);
 }
 
 QVariant File::get(const QString &key) const
@@ -148,6 +240,10 @@ QVariant File::get(const QString &key, const QVariant &defaultValue) const
 
 bool File::getBool(const QString &key) const
 {
+    if (const int f = flag(key)) {
+        if (m_flags & f) return true;
+        if (m_flags & falseFlag(f)) return false;
+    }
     if (!contains(key)) return false;
     QString v = value(key).toString();
     if (v.isEmpty() || (v == "true")) return true;
@@ -157,8 +253,17 @@ bool File::getBool(const QString &key) const
 
 void File::setBool(const QString &key, bool value)
 {
-    if (value) m_metadata.insert(key, QVariant());
-    else       m_metadata.remove(key);
+    if (const int f = flag(key)) {
+        m_flags &= ~(f | falseFlag(f));
+        if (value) m_flags |= f;
+    } else if (value) {
+        set(key, QVariant());
+    } else {
+        const int slot = affineSlot(key);
+        if      (slot >= 0)      m_affineSet &= ~(1 << slot);
+        else if (key == "Label") { m_label = QVariant(); m_flags &= ~HasLabel; }
+        else                     m_metadata.remove(key);
+    }
 }
 
 int File::getInt(const QString &key) const
@@ -205,66 +310,62 @@ QString File::getString(const QString &key, const QString &defaultValue) const
     return value(key).toString();
 }
 
+bool File::affinePoint(int index, QPointF *point) const
+{
+    const int bits = 3 << (2*index);
+    if ((m_affineSet & bits) != bits) return false;
+    *point = QPointF(m_affine[2*index], m_affine[2*index+1]);
+    return true;
+}
+
+void File::setAffinePoint(int index, const QPointF &point)
+{
+    m_affine[2*index] = point.x();
+    m_affine[2*index+1] = point.y();
+    m_affineSet |= 3 << (2*index);
+}
+
 QList<QPointF> File::landmarks() const
 {
-    QList<QPointF> landmarks;
-    foreach (const QVariant &landmark, value("Landmarks").toList())
-        landmarks.append(landmark.toPointF());
-    return landmarks;
+    return m_landmarks;
 }
 
 void File::appendLandmark(const QPointF &landmark)
 {
-    QList<QVariant> newLandmarks = m_metadata["Landmarks"].toList();
-    newLandmarks.append(landmark);
-    m_metadata["Landmarks"] = newLandmarks;
+    m_landmarks.append(landmark);
 }
 
 void File::appendLandmarks(const QList<QPointF> &landmarks)
 {
-    QList<QVariant> newLandmarks = m_metadata["Landmarks"].toList();
-    foreach (const QPointF &landmark, landmarks)
-        newLandmarks.append(landmark);
-    m_metadata["Landmarks"] = newLandmarks;
+    m_landmarks.append(landmarks);
 }
 
 void File::setLandmarks(const QList<QPointF> &landmarks)
 {
-    QList<QVariant> landmarkList; landmarkList.reserve(landmarks.size());
-    foreach (const QPointF &landmark, landmarks)
-        landmarkList.append(landmark);
-    m_metadata["Landmarks"] = landmarkList;
+    m_landmarks = landmarks;
 }
 
 QList<QRectF> File::ROIs() const
 {
-    QList<QRectF> ROIs;
-    foreach (const QVariant &ROI, value("ROIs").toList())
+    QList<QRectF> ROIs; ROIs.reserve(m_ROIs.size());
+    foreach (const QRectF &ROI, m_ROIs)
         ROIs.append(ROI.toRect());
     return ROIs;
 }
 
 void File::appendROI(const QRectF &ROI)
 {
-    QList<QVariant> newROIs = m_metadata["ROIs"].toList();
-    newROIs.append(ROI);
-    m_metadata["ROIs"] = newROIs;
+    m_ROIs.append(ROI);
 }
 
 void File::appendROIs(const QList<QRectF> &ROIs)
 {
-    QList<QVariant> newROIs = m_metadata["ROIs"].toList();
-    foreach (const QRectF &ROI, ROIs)
-        newROIs.append(ROI);
-    m_metadata["ROIs"] = newROIs;
+    m_ROIs.append(ROIs);
 }
 
 void File::setROIs(const QList<QRectF> &ROIs)
 {
-    QList<QVariant> ROIList; ROIList.reserve(ROIs.size());
-    foreach (const QRectF &ROI, ROIs)
-        ROIList.append(ROI);
-    m_metadata["ROIs"] = ROIList;
+    m_ROIs = ROIs;
 }
 
 /* File - private methods */
@@ -300,6 +401,57 @@ void File::init(const QString &file)
     if (exists()) name = QDir().relativeFilePath(name);
 }
 
+int File::flag(const QString &key)
+{
+    if (key == "FTE") return FTE;
+    if (key == "FTO") return FTO;
+    return 0;
+}
+
+int File::affineSlot(const QString &key)
+{
+    // Affine_<0-2>_<X|Y>
+    if ((key.size() != 10) || !key.startsWith("Affine_") || (key[8] != '_')) return -1;
+    const int index = key[7].unicode() - '0';
+    if ((index < 0) || (index > 2)) return -1;
+    if (key[9] == 'X') return 2*index;
+    if (key[9] == 'Y') return 2*index+1;
+    return -1;
+}
+
+QString File::affineKey(int slot)
+{
+    return QString("Affine_%1_%2").arg(slot/2).arg(slot % 2 == 0 ? "X" : "Y");
+}
+
+bool File::setMember(const QString &key, const QVariant &value)
+{
+    const int slot = affineSlot(key);
+    if (slot >= 0) {
+        m_affine[slot] = value.toDouble();
+        m_affineSet |= 1 << slot;
+    } else if (key == "Label") {
+        m_label = value;
+        m_flags |= HasLabel;
+    } else if (key == "Landmarks") {
+        m_landmarks.clear();
+        foreach (const QVariant &landmark, value.toList())
+            m_landmarks.append(landmark.toPointF());
+    } else if (key == "ROIs") {
+        m_ROIs.clear();
+        foreach (const QVariant &ROI, value.toList())
+            m_ROIs.append(ROI.toRectF());
+    } else if (const int f = flag(key)) {
+        const QString v = value.toString();
+        m_flags &= ~(f | falseFlag(f));
+        if (v.isEmpty() || (v == "true") || ((v != "false") && v.toInt())) m_flags |= f;
+        else                                                               m_flags |= falseFlag(f);
+    } else {
+        return false;
+    }
+    return true;
+}
+
 /* File - global methods */
 QDebug br::operator<<(QDebug dbg, const File &file)
 {
@@ -308,12 +460,82 @@ QDebug br::operator<<(QDebug dbg, const File &file)
 
 QDataStream &br::operator<<(QDataStream &stream, const File &file)
 {
-    return stream << file.name << file.m_metadata;
+    stream << file.name << TypedFileMarker << file.m_flags << file.m_affineSet;
+    if (file.m_flags & File::HasLabel) stream << file.m_label;
+
+    // Typed fields are written as raw double precision values instead of QVariants
+    const QDataStream::FloatingPointPrecision precision = stream.floatingPointPrecision();
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+    for (int i=0; i<6; i++)
+        if (file.m_affineSet & (1 << i)) stream << file.m_affine[i];
+    stream << quint32(file.m_landmarks.size());
+    foreach (const QPointF &landmark, file.m_landmarks)
+        stream << landmark.x() << landmark.y();
+    stream << quint32(file.m_ROIs.size());
+    foreach (const QRectF &ROI, file.m_ROIs)
+        stream << ROI.x() << ROI.y() << ROI.width() << ROI.height();
+    stream.setFloatingPointPrecision(precision);
+
+    return stream << file.m_metadata;
 }
 
 QDataStream &br::operator>>(QDataStream &stream, File &file)
 {
-    return stream >> file.name >> file.m_metadata;
+    file.clear();
+    stream >> file.name;
+
+    quint32 marker;
+    stream >> marker;
+    if (marker != TypedFileMarker) {
+        // Legacy serialization, the marker is the size of the metadata table
+        for (quint32 i=0; i<marker && stream.status() == QDataStream::Ok; i++) {
+            QString key;
+            QVariant value;
+            stream >> key >> value;
+            if (!file.setMember(key, value))
+                file.m_metadata.insert(intern(key), value);
+        }
+        return stream;
+    }
+
+    stream >> file.m_flags >> file.m_affineSet;
+    if (file.m_flags & File::HasLabel) stream >> file.m_label;
+
+    const QDataStream::FloatingPointPrecision precision = stream.floatingPointPrecision();
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+    for (int i=0; i<6; i++)
+        if (file.m_affineSet & (1 << i)) stream >> file.m_affine[i];
+    quint32 size;
+    stream >> size;
+    for (quint32 i=0; i<size && stream.status() == QDataStream::Ok; i++) {
+        double x, y;
+        stream >> x >> y;
+        file.m_landmarks.append(QPointF(x, y));
+    }
+    stream >> size;
+    for (quint32 i=0; i<size && stream.status() == QDataStream::Ok; i++) {
+        double x, y, width, height;
+        stream >> x >> y >> width >> height;
+        file.m_ROIs.append(QRectF(x, y, width, height));
+    }
+    stream.setFloatingPointPrecision(precision);
+
+    QHash<QString,QVariant> metadata;
+    stream >> metadata;
+    for (QHash<QString,QVariant>::const_iterator it = metadata.constBegin(); it != metadata.constEnd(); ++it)
+        file.m_metadata.insert(intern(it.key()), it.value());
+    return stream;
+}
+
+/* Template - global methods */
+QDataStream &br::operator<<(QDataStream &stream, const Template &t)
+{
+    return stream << static_cast<const QList<cv::Mat>&>(t) << t.file;
+}
+
+QDataStream &br::operator>>(QDataStream &stream, Template &t)
+{
+    return stream >> static_cast<QList<cv::Mat>&>(t) >> t.file;
 }
 
 /* FileList - public methods */
@@ -392,6 +614,70 @@ TemplateList TemplateList::fromInput(const br::File &input)
     return templates;
 }
 
+/* TemplateSource - public methods */
+// Reads the galleries of an input in blocks, merging them in lockstep if requested
+class InputSource : public TemplateSource
+{
+    File input;
+    QList< QSharedPointer<Gallery> > galleries;
+    int current, index;
+    bool exhausted;
+
+public:
+    InputSource(const File &input)
+        : input(input)
+    {
+        rewind();
+    }
+
+    void rewind()
+    {
+        galleries.clear();
+        foreach (const br::File &file, input.split())
+            galleries.append(QSharedPointer<Gallery>(Gallery::make(file)));
+        current = index = 0;
+        exhausted = galleries.isEmpty();
+    }
+
+    bool read(TemplateList &block)
+    {
+        block.clear();
+        if (input.getBool("merge")) {
+            while (!exhausted && block.isEmpty()) {
+                for (int i=0; i<galleries.size(); i++) {
+                    bool done = false;
+                    const TemplateList newTemplates = galleries[i]->readBlock(&done);
+                    exhausted = exhausted || done;
+                    if (i == 0) {
+                        block = newTemplates;
+                    } else {
+                        if (newTemplates.size() != block.size()) qFatal("Inputs must be the same size in order to merge.");
+                        for (int j=0; j<block.size(); j++)
+                            block[j].merge(newTemplates[j]);
+                    }
+                }
+            }
+        } else {
+            while (block.isEmpty() && (current < galleries.size())) {
+                bool done = false;
+                block = galleries[current]->readBlock(&done);
+                if (done) current++;
+            }
+        }
+
+        for (int i=0; i<block.size(); i++) {
+            block[i].file.append(input.localMetadata());
+            block[i].file.insert("Input_Index", index++);
+        }
+        return !block.isEmpty();
+    }
+};
+
+TemplateSource *TemplateSource::fromInput(const File &input)
+{
+    return new InputSource(input);
+}
+
 /* Object - public methods */
 QString Object::name() const
 {
@@ -848,6 +1134,29 @@ void Output::reformat(const FileList &targetFiles, const FileList &queryFiles, c
             o->setRelative(m.at<float>(i,i), i, j);
 }
 
+static QList<OutputObserver*> OutputObservers;
+static QMutex OutputObserversLock;
+
+void Output::addObserver(OutputObserver *observer)
+{
+    QMutexLocker locker(&OutputObserversLock);
+    OutputObservers.append(observer);
+}
+
+void Output::removeObserver(OutputObserver *observer)
+{
+    QMutexLocker locker(&OutputObserversLock);
+    OutputObservers.removeAll(observer);
+}
+
+bool Output::cancelled() const
+{
+    QMutexLocker locker(&OutputObserversLock);
+    foreach (OutputObserver *observer, OutputObservers)
+        if (observer->cancelled(file)) return true;
+    return false;
+}
+
 /* Output - protected methods */
 void Output::initialize(const FileList &targetFiles, const FileList &queryFiles)
 {
@@ -856,6 +1165,13 @@ void Output::initialize(const FileList &targetFiles, const FileList &queryFiles)
     selfSimilar = (queryFiles == targetFiles) && (targetFiles.size() > 1) && (queryFiles.size() > 1);
 }
 
+void Output::publish(const QList<float> &scores, const FileList &targets, const FileList &queries) const
+{
+    QMutexLocker locker(&OutputObserversLock);
+    foreach (OutputObserver *observer, OutputObservers)
+        observer->snapshot(file, scores, targets, queries);
+}
+
 /* MatrixOutput - public methods */
 void MatrixOutput::initialize(const FileList &targetFiles, const FileList &queryFiles)
 {
@@ -910,12 +1226,17 @@ Gallery *Gallery::make(const File &file)
     return gallery;
 }
 
+static bool Downsamples(const Transform *transform)
+{
+    return (transform->classes != std::numeric_limits<int>::max()) ||
+           (transform->instances != std::numeric_limits<int>::max()) ||
+           (transform->fraction < 1);
+}
+
 static TemplateList Downsample(const TemplateList &templates, const Transform *transform)
 {
     // Return early when no downsampling is required
-    if ((transform->classes == std::numeric_limits<int>::max()) &&
-        (transform->instances == std::numeric_limits<int>::max()) &&
-        (transform->fraction >= 1))
+    if (!Downsamples(transform))
         return templates;
 
     const bool atLeast = transform->instances < 0;
@@ -999,9 +1320,111 @@ private:
         return new Independent(transforms.first()->clone());
     }
 
-    static void _train(Transform *transform, const TemplateList *data)
+    static void _train(Transform *transform, const TemplateList *data, int index)
+    {
+        transform->train(view(*data, index));
+    }
+
+    static void _trainBlock(Transform *transform, const TemplateList *data, int index)
+    {
+        transform->trainBlock(view(*data, index));
+    }
+
+    static void _finishTrain(Transform *transform)
+    {
+        transform->finishTrain();
+    }
+
+    // Number of matrix indices, warning about templates that don't have all of them
+    static int indices(const TemplateList &data, bool warn)
+    {
+        int size = 0;
+        foreach (const Template &t, data) {
+            if (warn && (size != t.size()) && (size != 0))
+                qWarning("Independent::train template %s of size %d differs from expected size %d.", qPrintable((QString)t.file), t.size(), size);
+            size = std::max(size, t.size());
+        }
+        return size;
+    }
+
+    // Matrix index of each template as its own template, sharing the matrix data
+    static TemplateList view(const TemplateList &data, int index)
+    {
+        TemplateList templates;
+        templates.reserve(data.size());
+        foreach (const Template &t, data)
+            if (index < t.size()) templates.append(Template(t.file, t[index]));
+        return templates;
+    }
+
+    bool trainable() const
+    {
+        return transforms.first()->trainable();
+    }
+
+    bool decodeHints(File &hints) const
     {
-        transform->train(*data);
+        return transforms.first()->decodeHints(hints);
+    }
+
+    bool batched() const
+    {
+        return transforms.first()->batched();
+    }
+
+    void setDecodeHints(const File &hints)
+    {
+        foreach (Transform *transform, transforms)
+            transform->setDecodeHints(hints);
+    }
+
+    // Downsampling needs the complete training set, so it is buffered here and given to train()
+    void beginTrain()
+    {
+        if (!trainable()) return;
+        if (Downsamples(transforms.first())) Transform::beginTrain();
+        else foreach (Transform *transform, transforms) transform->beginTrain();
+    }
+
+    void trainBlock(const TemplateList &data)
+    {
+        if (!trainable()) return;
+        if (Downsamples(transforms.first())) {
+            Transform::trainBlock(data);
+            return;
+        }
+
+        // Each index's view is built by the thread training on it
+        const int size = indices(data, true);
+        while (transforms.size() < size) {
+            transforms.append(transforms.first()->clone());
+            transforms.last()->beginTrain();
+        }
+
+        QList< QFuture<void> > futures;
+        const bool threaded = Globals->parallelism && (size > 1);
+        for (int i=0; i<size; i++) {
+            if (threaded) futures.append(QtConcurrent::run(_trainBlock, transforms[i], &data, i));
+            else                                           _trainBlock (transforms[i], &data, i);
+        }
+        if (threaded) Globals->trackFutures(futures);
+    }
+
+    void finishTrain()
+    {
+        if (!trainable()) return;
+        if (Downsamples(transforms.first())) {
+            Transform::finishTrain();
+            return;
+        }
+
+        QList< QFuture<void> > futures;
+        const bool threaded = Globals->parallelism && (transforms.size() > 1);
+        foreach (Transform *transform, transforms) {
+            if (threaded) futures.append(QtConcurrent::run(_finishTrain, transform));
+            else                                           _finishTrain (transform);
+        }
+        if (threaded) Globals->trackFutures(futures);
     }
 
     void train(const TemplateList &data)
@@ -1010,27 +1433,24 @@ private:
         if (dynamic_cast<UntrainableTransform*>(transforms.first()))
             return;
 
-        QList<TemplateList> templatesList;
-        foreach (const Template &t, data) {
-            if ((templatesList.size() != t.size()) && !templatesList.isEmpty())
-                qWarning("Independent::train template %s of size %d differs from expected size %d.", qPrintable((QString)t.file), t.size(), templatesList.size());
-            while (templatesList.size() < t.size())
-                templatesList.append(TemplateList());
-            for (int i=0; i<t.size(); i++)
-                templatesList[i].append(Template(t.file, t[i]));
-        }
-
-        while (transforms.size() < templatesList.size())
+        const int size = indices(data, true);
+        while (transforms.size() < size)
             transforms.append(transforms.first()->clone());
 
-        for (int i=0; i<templatesList.size(); i++)
-            templatesList[i] = Downsample(templatesList[i], transforms[i]);
+        // Downsampling draws from the shared random number generator, so it happens here in order.
+        // Otherwise each index's view is built by the thread training on it.
+        QList<TemplateList> downsampled;
+        if (Downsamples(transforms.first()))
+            for (int i=0; i<size; i++)
+                downsampled.append(TemplateList(Downsample(view(data, i), transforms[i])));
 
         QList< QFuture<void> > futures;
-        const bool threaded = Globals->parallelism && (templatesList.size() > 1);
-        for (int i=0; i<templatesList.size(); i++) {
-            if (threaded) futures.append(QtConcurrent::run(_train, transforms[i], &templatesList[i]));
-            else                                           _train (transforms[i], &templatesList[i]);
+        const bool threaded = Globals->parallelism && (size > 1);
+        for (int i=0; i<size; i++) {
+            const TemplateList *templates = downsampled.isEmpty() ? &data : &downsampled[i];
+            const int index = downsampled.isEmpty() ? i : 0;
+            if (threaded) futures.append(QtConcurrent::run(_train, transforms[i], templates, index));
+            else                                           _train (transforms[i], templates, index);
         }
 
         if (threaded) Globals->trackFutures(futures);
@@ -1046,6 +1466,34 @@ private:
         }
     }
 
+    void project(const TemplateList &src, TemplateList &dst) const
+    {
+        // Project matrix i of every template as one batch so children with batched paths can use them
+        const int size = indices(src, false);
+        QList<TemplateList> projected;
+        for (int i=0; i<size; i++) {
+            const TemplateList batch = view(src, i);
+            TemplateList batchDst;
+            transforms[i%transforms.size()]->project(batch, batchDst);
+            if (batchDst.size() != batch.size()) {
+                // The child doesn't map templates one to one
+                Transform::project(src, dst);
+                return;
+            }
+            projected.append(batchDst);
+        }
+
+        QVector<int> next(size, 0);
+        dst.reserve(dst.size() + src.size());
+        foreach (const Template &t, src) {
+            Template m;
+            m.file = t.file;
+            for (int i=0; i<t.size(); i++)
+                m.merge(projected[i][next[i]++]);
+            dst.append(m);
+        }
+    }
+
     void store(QDataStream &stream) const
     {
         const int size = transforms.size();
@@ -1120,6 +1568,35 @@ Transform *Transform::make(QString str, QObject *parent)
     return transform;
 }
 
+void Transform::beginTrain()
+{
+    trainingBlocks.clear();
+}
+
+void Transform::trainBlock(const TemplateList &data)
+{
+    trainingBlocks.append(data);
+}
+
+void Transform::finishTrain()
+{
+    const TemplateList data = trainingBlocks;
+    trainingBlocks.clear();
+    train(data);
+}
+
+void Transform::streamTrain(TemplateSource &source)
+{
+    if (!trainable()) return;
+
+    beginTrain();
+    source.rewind();
+    TemplateList block;
+    while (source.read(block))
+        trainBlock(block);
+    finishTrain();
+}
+
 Transform *Transform::clone() const
 {
     Transform *clone = Factory<Transform>::make(file.flat());
@@ -1130,8 +1607,42 @@ Transform *Transform::clone() const
     return clone;
 }
 
+cv::MatAllocator *br::matrixAllocator()
+{
+    return PooledAllocator::instance()->current();
+}
+
+MatrixAllocatorScope::MatrixAllocatorScope()
+    : installed(Globals->poolMatrices)
+{
+    if (installed) PooledAllocator::instance()->install();
+}
+
+MatrixAllocatorScope::~MatrixAllocatorScope()
+{
+    if (installed) PooledAllocator::instance()->uninstall();
+}
+
+void br::matrixAllocations(int *allocations, int *mallocs, bool reset)
+{
+    const PooledAllocator::Statistics statistics = PooledAllocator::instance()->statistics();
+    if (allocations) *allocations = statistics.allocations;
+    if (mallocs) *mallocs = statistics.mallocs;
+    if (reset) PooledAllocator::instance()->resetStatistics();
+}
+
+Template Transform::operator()(const Template &src) const
+{
+    MatrixAllocatorScope scope;
+    Template dst;
+    dst.file = src.file;
+    project(src, dst);
+    return dst;
+}
+
 static void _project(const Transform *transform, const Template *src, Template *dst)
 {
+    MatrixAllocatorScope scope;
     try {
         transform->project(*src, *dst);
     } catch (...) {
@@ -136,22 +136,25 @@ void reset_##NAME() { NAME = DEFAULT; }
  * Landmarks       | QList<QPointF> | Landmark list
  * ROIs            | QList<Rect>    | Region Of Interest (ROI) list
  * _*              | *              | Reserved for internal use
+ *
+ * \c Label, \c Affine_0_X through \c Affine_2_Y, \c Landmarks, \c ROIs, \c FTE and \c FTO are stored in typed members rather than the metadata table,
+ * and the remaining keys are interned so that files loaded from the same gallery share their key strings.
  */
 struct BR_EXPORT File
 {
     QString name; /*!< \brief Path to a file on disk. */
 
-    File() {}
-    File(const QString &file) { init(file); } /*!< \brief Construct a file from a string. */
-    File(const QString &file, const QVariant &label) { init(file); insert("Label", label); } /*!< \brief Construct a file from a string and assign a label. */
-    File(const char *file) { init(file); } /*!< \brief Construct a file from a c-style string. */
+    File() : m_flags(0), m_affineSet(0) {}
+    File(const QString &file) : m_flags(0), m_affineSet(0) { init(file); } /*!< \brief Construct a file from a string. */
+    File(const QString &file, const QVariant &label) : m_flags(0), m_affineSet(0) { init(file); insert("Label", label); } /*!< \brief Construct a file from a string and assign a label. */
+    File(const char *file) : m_flags(0), m_affineSet(0) { init(file); } /*!< \brief Construct a file from a c-style string. */
     operator QString() const { return name; } /*!< \brief Returns #name. */
     QString flat() const; /*!< \brief A stringified version of the file with metadata. */
     QString hash() const; /*!< \brief A hash of the file. */
-    inline void clear() { name.clear(); m_metadata.clear(); } /*!< \brief Clears the file's name and metadata. */
+    inline void clear() { name.clear(); m_metadata.clear(); m_label = QVariant(); m_landmarks.clear(); m_ROIs.clear(); m_flags = 0; m_affineSet = 0; } /*!< \brief Clears the file's name and metadata. */
 
-    inline QList<QString> localKeys() const { return m_metadata.keys(); } /*!< \brief Returns the private metadata keys. */
-    inline QHash<QString,QVariant> localMetadata() const { return m_metadata; } /*!< \brief Returns the private metadata. */
+    QList<QString> localKeys() const; /*!< \brief Returns the private metadata keys. */
+    QHash<QString,QVariant> localMetadata() const; /*!< \brief Returns the private metadata. */
     inline void insert(const QString &key, const QVariant &value) { set(key, value); } /*!< \brief Equivalent to set(). */
     void append(const QHash<QString,QVariant> &localMetadata); /*!< \brief Add new metadata fields. */
     void append(const File &other); /*!< \brief Append another file using \c separator. */
@@ -163,7 +166,7 @@ struct BR_EXPORT File
     inline QVariant parameter(int index) const { return m_metadata.value("_Arg" + QString::number(index)); } /*!< \brief Retrieve a keyless value. */
 
     inline bool operator==(const char* other) const { return name == other; } /*!< \brief Compare name to c-style string. */
-    inline bool operator==(const File &other) const { return (name == other.name) && (m_metadata == other.m_metadata); } /*!< \brief Compare name and metadata for equality. */
+    inline bool operator==(const File &other) const { return (name == other.name) && (m_flags == other.m_flags) && (m_label == other.m_label) && (m_affineSet == other.m_affineSet) && equalAffine(other) && (m_landmarks == other.m_landmarks) && (m_ROIs == other.m_ROIs) && (m_metadata == other.m_metadata); } /*!< \brief Compare name and metadata for equality. */
     inline bool operator!=(const File &other) const { return !(*this == other); } /*!< \brief Compare name and metadata for inequality. */
     inline bool operator<(const File &other) const { return name < other.name; } /*!< \brief Compare name. */
     inline bool operator<=(const File &other) const { return name <= other.name; } /*!< \brief Compare name. */
@@ -172,7 +175,7 @@ struct BR_EXPORT File
     inline File &operator+=(const QHash<QString,QVariant> &other) { append(other); return *this; } /*!< \brief Add new metadata fields. */
     inline File &operator+=(const File &other) { append(other); return *this; } /*!< \brief Append another file using \c separator. */
 
-    inline bool isNull() const { return name.isEmpty() && m_metadata.isEmpty(); } /*!< \brief Returns \c true if name and metadata are empty, \c false otherwise. */
+    inline bool isNull() const { return name.isEmpty() && m_metadata.isEmpty() && m_landmarks.isEmpty() && m_ROIs.isEmpty() && !m_flags && !m_affineSet; } /*!< \brief Returns \c true if name and metadata are empty, \c false otherwise. */
     inline bool isTerminal() const { return name == "terminal"; } /*!< \brief Returns \c true if #name is "terminal", \c false otherwise. */
     inline bool exists() const { return QFileInfo(name).exists(); } /*!< \brief Returns \c true if the file exists on disk, \c false otherwise. */
     inline QString fileName() const { return QFileInfo(name).fileName(); } /*!< \brief Returns the file's base name and extension. */
@@ -184,7 +187,7 @@ struct BR_EXPORT File
     QVariant value(const QString &key) const; /*!< \brief Returns the value for the specified key. */
     static QString subject(int label); /*!< \brief Looks up the subject for the provided label. */
     inline QString subject() const { return subject(label()); } /*!< \brief Looks up the subject from the file's label. */
-    inline bool failed() const { return getBool("FTE") || getBool("FTO"); } /*!< \brief Returns \c true if the file failed to open or enroll, \c false otherwise. */
+    inline bool failed() const { return (m_flags & (FTE | FTO)) != 0; } /*!< \brief Returns \c true if the file failed to open or enroll, \c false otherwise. */
 
     void set(const QString &key, const QVariant &value); /*!< \brief Insert or overwrite the metadata key with the specified value. */
     QVariant get(const QString &key) const; /*!< \brief Returns a QVariant for the key, throwing an error if the key does not exist. */
@@ -200,24 +203,42 @@ struct BR_EXPORT File
     QString getString(const QString &key) const; /*!< \brief Returns a string value for the key, throwing an error if the key does not exist. */
     QString getString(const QString &key, const QString &defaultValue) const; /*!< \brief Returns a string value for the key, returning \em defaultValue if the key does not exist. */
 
+    bool affinePoint(int index, QPointF *point) const; /*!< \brief Retrieves \c Affine_<index>_X and \c Affine_<index>_Y, returning \c false if either is missing. */
+    void setAffinePoint(int index, const QPointF &point); /*!< \brief Assigns \c Affine_<index>_X and \c Affine_<index>_Y. */
+
     QList<QPointF> landmarks() const; /*!< \brief Returns the file's landmark list. */
     void appendLandmark(const QPointF &landmark); /*!< \brief Adds a landmark to the file's landmark list. */
     void appendLandmarks(const QList<QPointF> &landmarks); /*!< \brief Adds landmarks to the file's landmark list. */
-    inline void clearLandmarks() { m_metadata["Landmarks"] = QList<QVariant>(); } /*!< \brief Clears the file's landmark list. */
+    inline void clearLandmarks() { m_landmarks.clear(); } /*!< \brief Clears the file's landmark list. */
     void setLandmarks(const QList<QPointF> &landmarks); /*!< \brief Assigns the file's landmark list. */
 
     QList<QRectF> ROIs() const; /*!< \brief Returns the file's ROI list. */
     void appendROI(const QRectF &ROI); /*!< \brief Adds a ROI to the file's ROI list. */
     void appendROIs(const QList<QRectF> &ROIs); /*!< \brief Adds ROIs to the file's ROI list. */
-    inline void clearROIs() { m_metadata["ROIs"] = QList<QVariant>(); } /*!< \brief Clears the file's landmark list. */
+    inline void clearROIs() { m_ROIs.clear(); } /*!< \brief Clears the file's landmark list. */
     void setROIs(const QList<QRectF> &ROIs); /*!< \brief Assigns the file's landmark list. */
 
 private:
-    QHash<QString,QVariant> m_metadata;
+    enum Flag { FTE = 0x1, FTO = 0x2, HasLabel = 0x4,
+                FalseFTE = FTE << 3, FalseFTO = FTO << 3 }; // FTE or FTO present with the value false
+
+    QHash<QString,QVariant> m_metadata; // Keys without a typed member below
+    QVariant m_label;
+    double m_affine[6]; // Affine_0_X, Affine_0_Y, ..., Affine_2_Y
+    QList<QPointF> m_landmarks;
+    QList<QRectF> m_ROIs;
+    quint8 m_flags; // Combination of Flag
+    quint8 m_affineSet; // Bit i set if m_affine[i] is assigned
     BR_EXPORT friend QDataStream &operator<<(QDataStream &stream, const File &file); /*!< */
     BR_EXPORT friend QDataStream &operator>>(QDataStream &stream, File &file); /*!< */
 
     void init(const QString &file);
+    static int flag(const QString &key); // Flag for the key, or zero
+    static int falseFlag(int flag) { return flag << 3; } // Flag for the key being present with the value false
+    static int affineSlot(const QString &key); // Index into m_affine for the key, or -1
+    static QString affineKey(int slot);
+    bool setMember(const QString &key, const QVariant &value); // Assigns a typed member, false if the key has none
+    inline bool equalAffine(const File &other) const { for (int i=0; i<6; i++) if ((m_affineSet & (1 << i)) && (m_affine[i] != other.m_affine[i])) return false; return true; }
 };
 
 BR_EXPORT QDebug operator<<(QDebug dbg, const File &file); /*!< \brief Prints br::File::flat() to \c stderr. */
@@ -242,6 +263,34 @@ struct BR_EXPORT FileList : public QList<File>
     int failures() const; /*!< \brief Returns the number of files with br::File::failed(). */
 };
 
+/*!
+ * \brief Allocator assigned to matrices created by br::Template::m() on the calling thread.
+ *
+ * Returns the pooled allocator while a br::MatrixAllocatorScope is alive on the thread and br::Context::poolMatrices is \c true,
+ * otherwise \c NULL (the OpenCV default).
+ */
+BR_EXPORT cv::MatAllocator *matrixAllocator();
+
+/*!
+ * \brief Makes br::matrixAllocator() return the pooled allocator on the calling thread for the lifetime of the object.
+ *
+ * br::Transform::project() and br::Transform::operator()() already install one around each template,
+ * transforms that project on their own threads install one around the work they do there.
+ * Has no effect when br::Context::poolMatrices is \c false.
+ */
+class BR_EXPORT MatrixAllocatorScope
+{
+    bool installed;
+public:
+    MatrixAllocatorScope();
+    ~MatrixAllocatorScope();
+};
+
+/*!
+ * \brief Matrices allocated through br::matrixAllocator() since the last reset, and how many of them had to go to the system allocator.
+ */
+BR_EXPORT void matrixAllocations(int *allocations, int *mallocs, bool reset = false);
+
 /*!
  * \brief A list of matrices associated with a file.
  *
@@ -265,7 +314,8 @@ struct Template : public QList<cv::Mat>
 
     inline const cv::Mat &m() const { static const cv::Mat NullMatrix;
                                       return isEmpty() ? qFatal("Template::m() empty template."), NullMatrix : last(); } /*!< \brief Idiom to treat the template as a matrix. */
-    inline cv::Mat &m() { return isEmpty() ? append(cv::Mat()), last() : last(); } /*!< \brief Idiom to treat the template as a matrix. */
+    inline cv::Mat &m() { if (isEmpty()) { append(cv::Mat()); last().allocator = matrixAllocator(); }
+                          return last(); } /*!< \brief Idiom to treat the template as a matrix. */
     inline cv::Mat &operator=(const cv::Mat &other) { return m() = other; } /*!< \brief Idiom to treat the template as a matrix. */
     inline operator const cv::Mat&() const { return m(); } /*!< \brief Idiom to treat the template as a matrix. */
     inline operator cv::Mat&() { return m(); } /*!< \brief Idiom to treat the template as a matrix. */
@@ -296,6 +346,9 @@ struct Template : public QList<cv::Mat>
     }
 };
 
+BR_EXPORT QDataStream &operator<<(QDataStream &stream, const Template &t); /*!< \brief Serializes the template to a stream. */
+BR_EXPORT QDataStream &operator>>(QDataStream &stream, Template &t); /*!< \brief Deserializes the template from a stream. */
+
 /*!
  * \brief A list of templates.
  *
@@ -484,6 +537,35 @@ public:
     Q_PROPERTY(bool enrollAll READ get_enrollAll WRITE set_enrollAll RESET reset_enrollAll)
     BR_PROPERTY(bool, enrollAll, false)
 
+    /*!
+     * \brief If \c true (default) matrices created while projecting templates are recycled through a per-thread pool instead of the system allocator.
+     */
+    Q_PROPERTY(bool poolMatrices READ get_poolMatrices WRITE set_poolMatrices RESET reset_poolMatrices)
+    BR_PROPERTY(bool, poolMatrices, true)
+
+    /*!
+     * \brief If \c true transforms are trained from the input one block at a time with br::Transform::streamTrain(), \c false by default.
+     *
+     * Streaming only bounds memory for transforms that learn from one block at a time:
+     * \ref PCA, \ref Center with \c Mean or \c Range, \ref KMeans with a \em batchSize, \ref Quantize,
+     * and Pipe and Chain, which re-project each block through the earlier stages instead of keeping intermediate templates.
+     * Every other transform (ex. LDA, SVM, Cascade, KMeans without a \em batchSize, Center with \c Median,
+     * and any transform that downsamples its training data) buffers all of its blocks and trains from them at the end,
+     * so it needs as much memory as it would without streaming.
+     * Fork's branches read the source one after another, one full pass each, rather than in parallel.
+     * The distance is not streamed either, every projected training template is held in memory to train it.
+     */
+    Q_PROPERTY(bool streamTraining READ get_streamTraining WRITE set_streamTraining RESET reset_streamTraining)
+    BR_PROPERTY(bool, streamTraining, false)
+
+    /*!
+     * \brief If greater than \c 0, comparisons visit target blocks in order of their best score against every \em prefilter th target, so the best matches tend to be found first. \c 0 by default.
+     *
+     * A comparison can override it with the \c prefilter argument of its output file.
+     */
+    Q_PROPERTY(int prefilter READ get_prefilter WRITE set_prefilter RESET reset_prefilter)
+    BR_PROPERTY(int, prefilter, 0)
+
     QHash<QString,QString> abbreviations; /*!< \brief Used by br::Transform::make() to expand abbreviated algorithms into their complete definitions. */
     QHash<QString,int> classes; /*!< \brief Used by classifiers to associate text class labels with unique integers IDs. */
     QTime startTime; /*!< \brief Used to estimate timeRemaining(). */
@@ -760,6 +842,27 @@ public:
  * \brief Plugins that store template comparison results.
  */
 
+/*!
+ * \brief Receives snapshots of the best matches an br::Output has found so far.
+ * \see Output::addObserver
+ */
+class BR_EXPORT OutputObserver
+{
+public:
+    virtual ~OutputObserver() {}
+
+    /*!
+     * \brief Called from a comparison thread with the best matches so far in descending order of score.
+     * \param output The output publishing the snapshot.
+     */
+    virtual void snapshot(const File &output, const QList<float> &scores, const FileList &targets, const FileList &queries) = 0;
+
+    /*!
+     * \brief Called from a comparison thread between blocks, return \c true to stop the comparison writing to \em output early.
+     */
+    virtual bool cancelled(const File &output) { (void) output; return false; }
+};
+
 /*!
  * \ingroup outputs
  * \brief Plugin base class for storing template comparison results.
@@ -783,9 +886,13 @@ public:
 
     static Output *make(const File &file, const FileList &targetFiles, const FileList &queryFiles); /*!< \brief Make an output from a file and gallery/probe file lists. */
     static void reformat(const FileList &targetFiles, const FileList &queryFiles, const File &simmat, const File &output); /*!< \brief Create an output from a similarity matrix and file lists. */
+    static void addObserver(OutputObserver *observer); /*!< \brief Receive snapshots published by every output until removeObserver(). */
+    static void removeObserver(OutputObserver *observer); /*!< \brief Stop receiving snapshots, waiting for any in progress to return. */
+    bool cancelled() const; /*!< \brief Returns \c true if an observer asked for the comparison writing to this output to stop. */
 
 protected:
     virtual void initialize(const FileList &targetFiles, const FileList &queryFiles); /*!< \brief Initializes class data members. */
+    void publish(const QList<float> &scores, const FileList &targets, const FileList &queries) const; /*!< \brief Send a snapshot of the best matches to the observers. */
 
 private:
     QSharedPointer<Output> next;
@@ -858,12 +965,28 @@ public:
     virtual TemplateList readBlock(bool *done) = 0; /*!< \brief Retrieve a portion of the stored templates. */
     void writeBlock(const TemplateList &templates); /*!< \brief Serialize a template list. */
     virtual void write(const Template &t) = 0; /*!< \brief Serialize a template. */
+    virtual qint64 position() { return -1; } /*!< \brief Where the next readBlock() starts, or \c -1 if the gallery can't seek(). */
+    virtual void seek(qint64 position) { (void) position; } /*!< \brief Continue reading from a previous position(). */
     static Gallery *make(const File &file); /*!< \brief Make a gallery from a file list. */
 
 private:
     QSharedPointer<Gallery> next;
 };
 
+/*!
+ * \brief A re-readable sequence of template blocks.
+ *
+ * Used by br::Transform::streamTrain() so that transforms which learn block by block never need the whole training set in memory.
+ */
+class BR_EXPORT TemplateSource
+{
+public:
+    virtual ~TemplateSource() {}
+    virtual void rewind() = 0; /*!< \brief Restart from the first block. */
+    virtual bool read(TemplateList &block) = 0; /*!< \brief Retrieve the next block, returning \c false when every block has been read. */
+    static TemplateSource *fromInput(const File &input); /*!< \brief The templates of TemplateList::fromInput() one gallery block at a time. */
+};
+
 /*!
  * \defgroup transforms Transforms
  * \brief Plugins that process a template.
@@ -886,6 +1009,7 @@ class BR_EXPORT Transform : public Object
 {
     Q_OBJECT
     bool independent;
+    TemplateList trainingBlocks; // Buffered by the default trainBlock()
 
 public:
     Q_PROPERTY(bool relabel READ get_relabel WRITE set_relabel RESET reset_relabel STORED false)
@@ -903,19 +1027,21 @@ public:
 
     virtual Transform *clone() const; /*!< \brief Copy the transform. */
     virtual void train(const TemplateList &data) = 0; /*!< \brief Train the transform. */
+    virtual bool trainable() const { return true; } /*!< \brief Returns \c false if train() ignores its data. */
+    virtual void beginTrain(); /*!< \brief Prepare for a sequence of trainBlock() calls. */
+    virtual void trainBlock(const TemplateList &data); /*!< \brief Accumulate a block of training data, by default the block is kept in memory until finishTrain(). */
+    virtual void finishTrain(); /*!< \brief Complete training from the blocks given to trainBlock(), by default by calling train() on all of them at once. */
+    virtual void streamTrain(TemplateSource &source); /*!< \brief Train from a source one block at a time, by default one pass of beginTrain(), trainBlock() and finishTrain(), see br::Context::streamTraining for which transforms this saves memory for. */
     virtual void project(const Template &src, Template &dst) const = 0; /*!< \brief Apply the transform. */
     virtual void project(const TemplateList &src, TemplateList &dst) const; /*!< \brief Apply the transform. */
+    virtual bool batched() const { return false; } /*!< \brief Returns \c true if project(const TemplateList&, TemplateList&) shares work across templates rather than projecting each one on its own. */
+    virtual bool decodeHints(File &hints) const { (void) hints; return false; } /*!< \brief Adds to \em hints how much of its input the transform discards (\c minRows, \c minColumns, \c minSize, \c gray), returns \c false if it needs its input as decoded. */
+    virtual void setDecodeHints(const File &hints) { (void) hints; } /*!< \brief Receives the decodeHints() of the transforms that follow, see \ref PipeTransform "Pipe". */
 
     /*!
-     * \brief Convenience function equivalent to project().
+     * \brief Convenience function equivalent to project(), with matrices allocated from br::matrixAllocator().
      */
-    inline Template operator()(const Template &src) const
-    {
-        Template dst;
-        dst.file = src.file;
-        project(src, dst);
-        return dst;
-    }
+    Template operator()(const Template &src) const;
 
     /*!
      * \brief Convenience function equivalent to project().
@@ -992,6 +1118,10 @@ protected:
 private:
     Transform *clone() const { return const_cast<UntrainableTransform*>(this); }
     void train(const TemplateList &data) { (void) data; }
+    bool trainable() const { return false; }
+    void beginTrain() {}
+    void trainBlock(const TemplateList &data) { (void) data; }
+    void finishTrain() {}
     void store(QDataStream &stream) const { (void) stream; }
     void load(QDataStream &stream) { (void) stream; }
 };
@@ -28,15 +28,20 @@ class CascadeResourceMaker : public ResourceMaker<CascadeClassifier>
     QString file;
 
 public:
-    CascadeResourceMaker(const QString &model)
+    CascadeResourceMaker(const QString &file)
+        : file(file)
+    {}
+
+    static QString fileName(const QString &model)
     {
-        file = Globals->sdkPath + "/share/openbr/models/";
+        QString file = Globals->sdkPath + "/share/openbr/models/";
         if      (model == "Ear")         file += "haarcascades/haarcascade_ear.xml";
         else if (model == "Eye")         file += "haarcascades/eye_tree_eyeglasses.xml";
         else if (model == "FrontalFace") file += "haarcascades/haarcascade_frontalface_alt2.xml";
         else if (model == "Ocular")      file += "parojosG.xml";
         else if (model == "ProfileFace") file += "haarcascades/haarcascade_profileface.xml";
-        else                             qFatal("CascadeResourceMaker::CascadeResourceMaker invalid model.");
+        else                             qFatal("CascadeResourceMaker::fileName invalid model.");
+        return file;
     }
 
 private:
@@ -49,6 +54,28 @@ private:
     }
 };
 
+/*!
+ * \brief Makes the pool of classifiers shared by every Cascade using the same model file.
+ *
+ * CascadeClassifier::detectMultiScale is not reentrant, so each thread still needs its own classifier,
+ * but the pool bounds the number of parsed copies per model to the number of threads for the whole process.
+ */
+class CascadePoolMaker : public ResourceMaker< Resource<CascadeClassifier> >
+{
+    QString file;
+
+public:
+    CascadePoolMaker(const QString &file)
+        : file(file)
+    {}
+
+private:
+    Resource<CascadeClassifier> *make() const
+    {
+        return new Resource<CascadeClassifier>(new CascadeResourceMaker(file));
+    }
+};
+
 
 /*!
  * \ingroup transforms
@@ -63,19 +90,20 @@ class Cascade : public UntrainableTransform
     BR_PROPERTY(QString, model, "FrontalFace")
     BR_PROPERTY(int, minSize, 64)
 
-    Resource<CascadeClassifier> cascadeResource;
+    QSharedPointer< const Resource<CascadeClassifier> > cascadeResource;
 
     void init()
     {
-        cascadeResource.setResourceMaker(new CascadeResourceMaker(model));
+        const QString file = CascadeResourceMaker::fileName(model);
+        cascadeResource = ResourceRegistry< Resource<CascadeClassifier> >::get(file, CascadePoolMaker(file));
     }
 
     void project(const Template &src, Template &dst) const
     {
-        CascadeClassifier *cascade = cascadeResource.acquire();
+        CascadeClassifier *cascade = cascadeResource->acquire();
         vector<Rect> rects;
         cascade->detectMultiScale(src, rects, 1.2, 5, src.file.getBool("enrollAll") ? 0 : CV_HAAR_FIND_BIGGEST_OBJECT, Size(minSize, minSize));
-        cascadeResource.release(cascade);
+        cascadeResource->release(cascade);
 
         if (!src.file.getBool("enrollAll") && rects.empty())
             rects.push_back(Rect(0, 0, src.m().cols, src.m().rows));
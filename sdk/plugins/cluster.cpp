@@ -14,8 +14,11 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <QtConcurrentRun>
 #include <openbr_plugin.h>
-#include <opencv2/flann/flann.hpp>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif // __SSE__
 
 #include "core/opencvutils.h"
 
@@ -24,39 +27,295 @@ using namespace br;
 
 /*!
  * \ingroup transforms
- * \brief Wraps OpenCV kmeans
+ * \brief Wraps OpenCV kmeans, or trains with mini-batch updates when \em batchSize is positive.
+ *
+ * Mini-batch training follows Sculley's "Web-Scale K-Means Clustering",
+ * centers are refined from random batches of rows with per-center learning rates instead of full passes over the data.
+ * train() draws \em iterations random batches, converting only the sampled rows,
+ * while trainBlock() seeds the centers from the first rows it sees and makes one shuffled pass of batches over each block.
+ * Assignment is a brute-force search over the read-only centers and needs no locking.
  * \author Josh Klontz \cite jklontz
  */
 class KMeans : public Transform
 {
     Q_OBJECT
     Q_PROPERTY(int k READ get_k WRITE set_k RESET reset_k)
+    Q_PROPERTY(int batchSize READ get_batchSize WRITE set_batchSize RESET reset_batchSize)
+    Q_PROPERTY(int iterations READ get_iterations WRITE set_iterations RESET reset_iterations)
     BR_PROPERTY(int, k, 1)
+    BR_PROPERTY(int, batchSize, 0)
+    BR_PROPERTY(int, iterations, 100)
 
-    Mat centers;
-    QSharedPointer<flann::Index> index;
-    QSharedPointer<QMutex> indexLock;
+    Mat centers; // k x d, CV_32F
+    Mat halfNorms; // 1 x k, half the squared norm of each center
+
+    // Mini-batch state, accumulated by trainBlock()
+    QVector<int> counts; // Samples assigned to each center so far
+    QList<Mat> seeds; // Rows collected before k centers exist
+
+    static const int AssignBlock = 256; // Rows per matrix product in assign()
+
+    typedef QPair<const Mat*, int> Row; // Float rows of a template and a row index
 
     void reindex()
     {
-        index = QSharedPointer<flann::Index>(new flann::Index(centers, flann::LinearIndexParams()));
-        indexLock = QSharedPointer<QMutex>(new QMutex());
+        halfNorms.create(1, centers.rows, CV_32FC1);
+        for (int i=0; i<centers.rows; i++)
+            halfNorms.at<float>(i) = 0.5f * centers.row(i).dot(centers.row(i));
+    }
+
+    static inline float dot(const float *a, const float *b, int size)
+    {
+        float result = 0;
+        int i = 0;
+#ifdef __SSE__
+        __m128 accumulate = _mm_setzero_ps();
+        for (; i+4<=size; i+=4)
+            accumulate = _mm_add_ps(accumulate, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+        float buff[4];
+        _mm_storeu_ps(buff, accumulate);
+        result = buff[0] + buff[1] + buff[2] + buff[3];
+#endif // __SSE__
+        for (; i<size; i++)
+            result += a[i] * b[i];
+        return result;
+    }
+
+    // argmin |x-c|^2 = argmax x.c - |c|^2/2
+    int nearest(const float *row) const
+    {
+        const float *norms = halfNorms.ptr<float>();
+        int best = 0;
+        float bestScore = -FLT_MAX;
+        for (int i=0; i<centers.rows; i++) {
+            const float score = dot(row, centers.ptr<float>(i), centers.cols) - norms[i];
+            if (score > bestScore) {
+                bestScore = score;
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    // Assigns each row of data to its nearest center using blocked matrix products
+    void assign(const Mat &data, int *labels) const
+    {
+        Mat scores;
+        for (int begin=0; begin<data.rows; begin+=AssignBlock) {
+            const int end = std::min(begin+AssignBlock, data.rows);
+            gemm(data.rowRange(begin, end), centers, 1, Mat(), 0, scores, GEMM_2_T);
+            for (int i=0; i<scores.rows; i++) {
+                Mat row = scores.row(i);
+                row -= halfNorms;
+                Point maxLoc;
+                minMaxLoc(row, NULL, NULL, NULL, &maxLoc);
+                labels[begin+i] = maxLoc.x;
+            }
+        }
+    }
+
+    // Single channel rows without copying when the template is already CV_32F
+    static Mat floatRows(const Mat &m)
+    {
+        const Mat rows = m.reshape(1, m.rows);
+        if (rows.depth() == CV_32F) return rows;
+        Mat dst;
+        rows.convertTo(dst, CV_32F);
+        return dst;
+    }
+
+    // Enumerates the rows of data, matrices holds their single channel views
+    static QVector<Row> enumerate(const TemplateList &data, QList<Mat> &matrices)
+    {
+        QVector<Row> rows;
+        foreach (const Template &t, data)
+            matrices.append(t.m().reshape(1, t.m().rows));
+        for (int i=0; i<matrices.size(); i++) {
+            if (matrices[i].cols != matrices.first().cols)
+                qFatal("KMeans inconsistent sample size.");
+            for (int j=0; j<matrices[i].rows; j++)
+                rows.append(Row(&matrices[i], j));
+        }
+        return rows;
+    }
+
+    static inline void copyRow(const Row &row, Mat dst)
+    {
+        row.first->row(row.second).convertTo(dst, CV_32F);
+    }
+
+    // Moves each center toward its assigned rows of batch with learning rate 1/count
+    void update(const Mat &batch)
+    {
+        QVector<int> labels(batch.rows);
+        assign(batch, labels.data());
+        for (int i=0; i<batch.rows; i++) {
+            const int label = labels[i];
+            const float eta = 1.f / ++counts[label];
+            float *center = centers.ptr<float>(label);
+            const float *sample = batch.ptr<float>(i);
+            for (int j=0; j<centers.cols; j++)
+                center[j] += eta * (sample[j] - center[j]);
+        }
+        reindex();
+    }
+
+    void trainMiniBatch(const TemplateList &data)
+    {
+        QList<Mat> matrices;
+        QVector<Row> rows = enumerate(data, matrices);
+        if (rows.size() < k) qFatal("KMeans::trainMiniBatch fewer samples than clusters.");
+        centers.create(k, matrices.first().cols, CV_32FC1);
+
+        // Initialize from distinct random samples
+        RNG &rng = theRNG();
+        for (int i=0; i<k; i++) {
+            std::swap(rows[i], rows[rng.uniform(i, rows.size())]);
+            copyRow(rows[i], centers.row(i));
+        }
+        reindex();
+
+        counts = QVector<int>(k, 0);
+        Mat batch(std::min(batchSize, rows.size()), centers.cols, CV_32FC1);
+        for (int iteration=0; iteration<iterations; iteration++) {
+            for (int i=0; i<batch.rows; i++)
+                copyRow(rows[rng.uniform(0, rows.size())], batch.row(i));
+            update(batch);
+        }
+        counts.clear();
     }
 
     void train(const TemplateList &data)
     {
+        if (batchSize > 0) {
+            trainMiniBatch(data);
+            return;
+        }
+
         Mat bestLabels;
         const double compactness = kmeans(OpenCVUtils::toMatByRow(data.data()), k, bestLabels, TermCriteria(TermCriteria::MAX_ITER, 10, 0), 3, KMEANS_PP_CENTERS, centers);
         reindex();
         qDebug("KMeans compactness = %f", compactness);
     }
 
+    void beginTrain()
+    {
+        if (batchSize <= 0) {
+            Transform::beginTrain();
+            return;
+        }
+        centers.release();
+        counts = QVector<int>(k, 0);
+        seeds.clear();
+    }
+
+    void trainBlock(const TemplateList &data)
+    {
+        if (batchSize <= 0) {
+            Transform::trainBlock(data);
+            return;
+        }
+
+        QList<Mat> matrices;
+        QVector<Row> rows = enumerate(data, matrices);
+        RNG &rng = theRNG();
+        for (int i=rows.size()-1; i>0; i--)
+            std::swap(rows[i], rows[rng.uniform(0, i+1)]);
+
+        int next = 0;
+        while ((centers.rows < k) && (next < rows.size())) {
+            Mat seed;
+            copyRow(rows[next++], seed);
+            if (!seeds.isEmpty() && (seed.cols != seeds.first().cols))
+                qFatal("KMeans inconsistent sample size.");
+            seeds.append(seed);
+            if (seeds.size() == k) {
+                centers = OpenCVUtils::toMatByRow(seeds);
+                seeds.clear();
+                reindex();
+            }
+        }
+        if (next == rows.size()) return;
+        if (matrices.first().cols != centers.cols) qFatal("KMeans inconsistent sample size.");
+
+        Mat batch;
+        while (next < rows.size()) {
+            batch.create(std::min(batchSize, rows.size()-next), centers.cols, CV_32FC1);
+            for (int i=0; i<batch.rows; i++)
+                copyRow(rows[next++], batch.row(i));
+            update(batch);
+        }
+    }
+
+    void finishTrain()
+    {
+        if (batchSize <= 0) {
+            Transform::finishTrain();
+            return;
+        }
+        if (centers.rows < k) qFatal("KMeans::finishTrain fewer samples than clusters.");
+        counts.clear();
+    }
+
     void project(const Template &src, Template &dst) const
     {
-        Mat dists;
-        indexLock->lock();
-        index->knnSearch(src, dst, dists, 1);
-        indexLock->unlock();
+        const Mat m = floatRows(src);
+        CV_Assert(m.cols == centers.cols);
+
+        Mat labels(m.rows, 1, CV_32SC1);
+        for (int i=0; i<m.rows; i++)
+            labels.at<int>(i) = nearest(m.ptr<float>(i));
+        dst = labels;
+    }
+
+    // Assigns src[begin, end) as a few large matrix products, failures are marked FTE as in Transform::project()
+    void assignTemplates(const TemplateList *src, TemplateList *dst, int begin, int end) const
+    {
+        QList<Mat> matrices;
+        QList<int> indices;
+        for (int i=begin; i<end; i++) {
+            try {
+                const Mat m = floatRows(src->at(i));
+                CV_Assert(m.cols == centers.cols);
+                matrices.append(m);
+                indices.append(i);
+            } catch (...) {
+                qWarning("Exception triggered when processing %s with transform %s", qPrintable(src->at(i).file.flat()), qPrintable(name()));
+                (*dst)[i] = Template(src->at(i).file);
+                (*dst)[i].file.setBool("FTE");
+            }
+        }
+        if (matrices.isEmpty()) return;
+
+        const Mat data = OpenCVUtils::toMatByRow(matrices);
+        Mat labels(data.rows, 1, CV_32SC1);
+        assign(data, labels.ptr<int>());
+
+        int row = 0;
+        for (int i=0; i<indices.size(); i++) {
+            (*dst)[indices[i]] = Template(src->at(indices[i]).file, labels.rowRange(row, row+matrices[i].rows).clone());
+            row += matrices[i].rows;
+        }
+    }
+
+    bool batched() const
+    {
+        return true;
+    }
+
+    void project(const TemplateList &src, TemplateList &dst) const
+    {
+        dst.reserve(src.size());
+        for (int i=0; i<src.size(); i++) dst.append(Template());
+
+        // Stack the rows of each chunk of templates so assignment is a few large matrix products
+        QList< QFuture<void> > futures;
+        for (int begin=0; begin<src.size(); begin+=AssignBlock) {
+            const int end = std::min(begin+AssignBlock, src.size());
+            if (Globals->parallelism) futures.append(QtConcurrent::run(this, &KMeans::assignTemplates, &src, &dst, begin, end));
+            else                                                      assignTemplates(&src, &dst, begin, end);
+        }
+        if (Globals->parallelism) Globals->trackFutures(futures);
     }
 
     void load(QDataStream &stream)
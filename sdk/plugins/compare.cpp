@@ -14,6 +14,7 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <QtConcurrentRun>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <openbr_plugin.h>
 
@@ -174,4 +175,171 @@ class Identical : public Distance
 
 BR_REGISTER(Distance, Identical)
 
+/*!
+ * \ingroup distances
+ * \brief Re-ranks the best matches of a cheap distance with an expensive one.
+ *
+ * For each query the \em prefilter distance is computed against every target,
+ * and only the \em k highest scoring targets (all of them if \em k <= 0) with a score of at least \em threshold
+ * are compared again with the \em rescorer distance.
+ * The output gets the rescored value, or the sum of both scores if \em fuse is \c true.
+ * Pairs that were not rescored are marked with <tt>-std::numeric_limits<float>::max()</tt>.
+ *
+ * The stages compare the matrices at \em prefilterIndex and \em rescoreIndex of each template (negative values count from the end),
+ * so an algorithm can enroll a compact feature vector alongside, for example, key point descriptors.
+ * Candidates are selected within each block of targets given to compare().
+ * Scores are normalized with \em a and \em b like every distance, except for the marker of pairs that were not rescored.
+ */
+class Rerank : public Distance
+{
+    Q_OBJECT
+    Q_PROPERTY(QString prefilter READ get_prefilter WRITE set_prefilter RESET reset_prefilter STORED false)
+    Q_PROPERTY(QString rescorer READ get_rescorer WRITE set_rescorer RESET reset_rescorer STORED false)
+    Q_PROPERTY(int k READ get_k WRITE set_k RESET reset_k STORED false)
+    Q_PROPERTY(float threshold READ get_threshold WRITE set_threshold RESET reset_threshold STORED false)
+    Q_PROPERTY(int prefilterIndex READ get_prefilterIndex WRITE set_prefilterIndex RESET reset_prefilterIndex STORED false)
+    Q_PROPERTY(int rescoreIndex READ get_rescoreIndex WRITE set_rescoreIndex RESET reset_rescoreIndex STORED false)
+    Q_PROPERTY(bool fuse READ get_fuse WRITE set_fuse RESET reset_fuse STORED false)
+    BR_PROPERTY(QString, prefilter, "UCharL1")
+    BR_PROPERTY(QString, rescorer, "KeyPointMatcher")
+    BR_PROPERTY(int, k, 100)
+    BR_PROPERTY(float, threshold, -std::numeric_limits<float>::max())
+    BR_PROPERTY(int, prefilterIndex, 0)
+    BR_PROPERTY(int, rescoreIndex, -1)
+    BR_PROPERTY(bool, fuse, false)
+
+    QSharedPointer<Distance> prefilterDistance, rescoreDistance;
+
+    void init()
+    {
+        prefilterDistance = QSharedPointer<Distance>(Factory<Distance>::make("." + prefilter));
+        rescoreDistance = QSharedPointer<Distance>(Factory<Distance>::make("." + rescorer));
+    }
+
+    void train(const TemplateList &src)
+    {
+        prefilterDistance->train(select(src, prefilterIndex));
+        rescoreDistance->train(select(src, rescoreIndex));
+    }
+
+    void store(QDataStream &stream) const
+    {
+        Distance::store(stream);
+        prefilterDistance->store(stream);
+        rescoreDistance->store(stream);
+    }
+
+    void load(QDataStream &stream)
+    {
+        Distance::load(stream);
+        prefilterDistance->load(stream);
+        rescoreDistance->load(stream);
+    }
+
+    // Shortlisted pairs of one compare() call
+    struct Rescoring
+    {
+        TemplateList targets, queries; // Rescored matrices
+        QVector< QPair<int,int> > pairs; // (query, target)
+        Mat prefilterScores, scores;
+    };
+
+    // Templates holding only the matrix a stage compares, sharing the original data
+    static TemplateList select(const TemplateList &templates, int index)
+    {
+        TemplateList selected;
+        selected.reserve(templates.size());
+        foreach (const Template &t, templates) {
+            const int i = (index < 0) ? t.size() + index : index;
+            if ((i < 0) || (i >= t.size())) qFatal("Rerank::select invalid index %d for %s.", index, qPrintable(t.file.flat()));
+            selected.append(Template(t.file, t[i]));
+        }
+        return selected;
+    }
+
+    void compare(const TemplateList &target, const TemplateList &query, Output *output) const
+    {
+        const TemplateList prefilterTargets = select(target, prefilterIndex);
+        const TemplateList prefilterQueries = select(query, prefilterIndex);
+        const int threads = std::max(1, abs(Globals->parallelism));
+
+        // Prefilter every pair, split over the targets so a single query still uses every thread
+        Rescoring r;
+        r.targets = select(target, rescoreIndex);
+        r.queries = select(query, rescoreIndex);
+        r.prefilterScores = Mat(query.size(), target.size(), CV_32FC1);
+        Mat &prefilterScores = r.prefilterScores;
+        QList< QFuture<void> > futures;
+        const int targetStep = std::max(1, int(ceil(float(target.size()) / float(threads))));
+        for (int j=0; j<target.size(); j+=targetStep) {
+            const int end = std::min(j+targetStep, target.size());
+            if (Globals->parallelism) futures.append(QtConcurrent::run(this, &Rerank::prefilterBlock, prefilterTargets, prefilterQueries, &prefilterScores, j, end));
+            else                                                                  prefilterBlock (prefilterTargets, prefilterQueries, &prefilterScores, j, end);
+        }
+        if (Globals->parallelism) Globals->trackFutures(futures);
+
+        // Shortlist each query
+        QVector< QPair<int,int> > &pairs = r.pairs;
+        QVector< QPair<float,int> > candidates(target.size());
+        for (int i=0; i<query.size(); i++) {
+            const float *row = prefilterScores.ptr<float>(i);
+            for (int j=0; j<target.size(); j++)
+                candidates[j] = QPair<float,int>(row[j], j);
+
+            const int shortlist = (k > 0) ? std::min(k, candidates.size()) : candidates.size();
+            std::partial_sort(candidates.begin(), candidates.begin() + shortlist, candidates.end(), std::greater< QPair<float,int> >());
+            for (int j=0; j<shortlist; j++) {
+                if (candidates[j].first < threshold) break;
+                pairs.append(QPair<int,int>(i, candidates[j].second));
+            }
+        }
+
+        // Rescore the shortlisted pairs, split evenly over the threads
+        r.scores = Mat(query.size(), target.size(), CV_32FC1, Scalar(-std::numeric_limits<float>::max()));
+        futures.clear();
+        const int pairStep = std::max(1, int(ceil(float(pairs.size()) / float(threads))));
+        for (int p=0; p<pairs.size(); p+=pairStep) {
+            const int end = std::min(p+pairStep, pairs.size());
+            if (Globals->parallelism) futures.append(QtConcurrent::run(this, &Rerank::rescoreBlock, &r, p, end));
+            else                                                                  rescoreBlock (&r, p, end);
+        }
+        if (Globals->parallelism) Globals->trackFutures(futures);
+
+        for (int i=0; i<query.size(); i++) {
+            const float *row = r.scores.ptr<float>(i);
+            for (int j=0; j<target.size(); j++)
+                output->setRelative(row[j], i, j);
+        }
+    }
+
+    void prefilterBlock(const TemplateList &target, const TemplateList &query, Mat *prefilterScores, int begin, int end) const
+    {
+        for (int i=0; i<query.size(); i++)
+            for (int j=begin; j<end; j++)
+                prefilterScores->at<float>(i, j) = prefilterDistance->compare(target[j], query[i]);
+    }
+
+    // Normalized with a and b like Distance::compare(), pairs that were not rescored keep their marker
+    void rescoreBlock(Rescoring *r, int begin, int end) const
+    {
+        const float scale = property("a").toFloat(), shift = property("b").toFloat();
+        for (int p=begin; p<end; p++) {
+            const int i = r->pairs.at(p).first, j = r->pairs.at(p).second;
+            const float score = rescoreDistance->compare(r->targets.at(j), r->queries.at(i));
+            r->scores.at<float>(i, j) = scale * ((fuse ? r->prefilterScores.at<float>(i, j) + score : score) - shift);
+        }
+    }
+
+    float _compare(const Template &a, const Template &b) const
+    {
+        // A single pair is always rescored
+        const TemplateList prefilterPair = select(TemplateList() << a << b, prefilterIndex);
+        const TemplateList rescorePair = select(TemplateList() << a << b, rescoreIndex);
+        const float score = rescoreDistance->compare(rescorePair[0], rescorePair[1]);
+        return fuse ? prefilterDistance->compare(prefilterPair[0], prefilterPair[1]) + score : score;
+    }
+};
+
+BR_REGISTER(Distance, Rerank)
+
 #include "compare.moc"
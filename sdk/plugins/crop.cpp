@@ -57,6 +57,16 @@ class Resize : public UntrainableTransform
     {
         resize(src, dst, Size((columns == -1) ? src.m().cols*rows/src.m().rows : columns, rows));
     }
+
+    // Only the first transform to reduce the size determines how large the decoded image must be
+    bool decodeHints(File &hints) const
+    {
+        if (!hints.contains("minRows") && !hints.contains("minSize")) {
+            hints.insert("minRows", rows);
+            hints.insert("minColumns", columns);
+        }
+        return true;
+    }
 };
 
 BR_REGISTER(Transform, Resize)
@@ -82,6 +92,13 @@ class LimitSize : public UntrainableTransform
             if (m.cols > max) resize(m, dst, Size(max, std::max(1, m.rows * max / m.cols)));
             else              dst = m;
     }
+
+    bool decodeHints(File &hints) const
+    {
+        if (!hints.contains("minRows") && !hints.contains("minSize"))
+            hints.insert("minSize", max);
+        return true;
+    }
 };
 
 BR_REGISTER(Transform, LimitSize)
@@ -61,6 +61,13 @@ private:
             dst = mv[channel % (int)mv.size()];
         }
     }
+
+    bool decodeHints(File &hints) const
+    {
+        if ((code != Gray) || (channel != -1)) return false;
+        hints.setBool("gray");
+        return true;
+    }
 };
 
 BR_REGISTER(Transform, Cvt)
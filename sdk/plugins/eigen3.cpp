@@ -45,6 +45,12 @@ class PCA : public Transform
     Eigen::VectorXf mean, eVals;
     Eigen::MatrixXf eVecs;
 
+    // Accumulated by trainBlock()
+    int samples;
+    QList<Eigen::MatrixXf> blocks; // Buffered while there are no more samples than dimensions
+    Eigen::VectorXd sum;
+    Eigen::MatrixXd outerProducts;
+
     friend class DFFS;
     friend class LDA;
 
@@ -93,6 +99,83 @@ private:
         train(data);
     }
 
+    // Blocks are buffered until there are more samples than dimensions, and then folded into the covariance sums.
+    // Training on fewer samples than dimensions keeps the buffer and solves the smaller Gram matrix instead,
+    // so a dims x dims matrix is only allocated when it is no larger than the data itself.
+    void beginTrain()
+    {
+        samples = 0;
+        blocks.clear();
+        sum.resize(0);
+        outerProducts.resize(0, 0);
+    }
+
+    void accumulate(const Eigen::MatrixXd &block)
+    {
+        sum += block.rowwise().sum();
+        outerProducts += block * block.transpose();
+    }
+
+    void trainBlock(const TemplateList &data)
+    {
+        if (data.isEmpty()) return;
+        if (data.first().m().type() != CV_32FC1)
+            qFatal("PCA::trainBlock requires single channel 32-bit floating point matrices.");
+
+        if (samples == 0)
+            originalRows = data.first().m().rows;
+
+        const int dimsIn = (samples == 0) ? data.first().m().rows * data.first().m().cols
+                                          : (blocks.isEmpty() ? sum.rows() : blocks.first().rows());
+        Eigen::MatrixXf block(dimsIn, data.size());
+        for (int i=0; i<data.size(); i++) {
+            if (data[i].m().rows * data[i].m().cols != dimsIn)
+                qFatal("PCA::trainBlock inconsistent template size.");
+            block.col(i) = Eigen::Map<const Eigen::MatrixXf>(data[i].m().ptr<float>(), dimsIn, 1);
+        }
+        samples += data.size();
+
+        if (sum.rows() > 0) {
+            accumulate(block.cast<double>());
+            return;
+        }
+
+        blocks.append(block);
+        if (samples <= dimsIn) return;
+
+        // Enough samples that the covariance matrix is smaller than the buffer
+        sum = Eigen::VectorXd::Zero(dimsIn);
+        outerProducts = Eigen::MatrixXd::Zero(dimsIn, dimsIn);
+        foreach (const Eigen::MatrixXf &buffered, blocks)
+            accumulate(buffered.cast<double>());
+        blocks.clear();
+    }
+
+    void finishTrain()
+    {
+        if (samples < 2) qFatal("PCA::finishTrain insufficient samples.");
+
+        if (!blocks.isEmpty()) {
+            Eigen::MatrixXd data(blocks.first().rows(), samples);
+            int column = 0;
+            foreach (const Eigen::MatrixXf &block, blocks) {
+                data.middleCols(column, block.cols()) = block.cast<double>();
+                column += block.cols();
+            }
+            blocks.clear();
+            train(data);
+            return;
+        }
+
+        mean = (sum / samples).cast<float>();
+        const Eigen::MatrixXd cov = (outerProducts - sum * sum.transpose() / samples) / (samples - 1.0);
+        sum.resize(0);
+        outerProducts.resize(0, 0);
+
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eSolver(cov);
+        keepEigenvectors(eSolver.eigenvalues(), eSolver.eigenvectors(), cov.rows());
+    }
+
     void project(const Template &src, Template &dst) const
     {
         dst = cv::Mat(1, keep, CV_32FC1);
@@ -137,6 +220,11 @@ private:
         Eigen::MatrixXd allEVecs = eSolver.eigenvectors();
         if (dominantEigenEstimation) allEVecs = data * allEVecs;
 
+        keepEigenvectors(allEVals, allEVecs, dimsIn);
+    }
+
+    void keepEigenvectors(const Eigen::MatrixXd &allEVals, const Eigen::MatrixXd &allEVecs, int dimsIn)
+    {
         if (keep < 1) {
             // Keep eigenvectors that retain a certain energy percentage.
             double totalEnergy = allEVals.sum();
@@ -33,34 +33,61 @@
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <QThreadStorage>
+#include <QtConcurrentRun>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <limits>
 #include <openbr_plugin.h>
 
 #include "core/opencvutils.h"
+#include "core/resource.h"
 
 using namespace cv;
 using namespace br;
 
 /*!
- * \ingroup transforms
- * \brief Bolme, D.S.; Draper, B.A.; Beveridge, J.R.;
- * "Average of Synthetic Exact Filters,"
- * Computer Vision and Pattern Recognition, 2009. CVPR 2009.
- * IEEE Conference on , vol., no., pp.2105-2112, 20-25 June 2009
- * \author David Bolme
- * \author Josh Klontz \cite jklontz
+ * \brief Read-only ASEF eye locator model shared by all ASEFEyes instances.
  */
-class ASEFEyes : public UntrainableTransform
+struct ASEFModel
 {
-    Q_OBJECT
-
-    Mat left_filter_dft, right_filter_dft, lut;
+    Mat filters_dft; // conj(left) + i conj(right) in the Fourier domain, transposed, so one inverse transform yields both correlations
+    Mat lut;
     Rect left_rect, right_rect;
     int width, height;
+};
+
+/*!
+ * \brief Per-thread buffers reused by every ASEFEyes batch.
+ *
+ * Buffers only grow, smaller batches use their leading rows, so a thread allocates them once for its largest batch.
+ */
+struct ASEFWorkspace
+{
+    Mat tile, tiles, spectrum, columns, windows;
+
+    static Mat reserve(Mat &m, int rows, int cols, int type)
+    {
+        if ((m.rows < rows) || (m.cols != cols) || (m.type() != type)) m.create(rows, cols, type);
+        return m.rowRange(0, rows);
+    }
+};
+
+/*!
+ * \brief Loads an ASEF eye locator model and precomputes its filters in the Fourier domain.
+ */
+class ASEFModelMaker : public ResourceMaker<ASEFModel>
+{
+    QString fileName;
 
 public:
-    ASEFEyes()
+    ASEFModelMaker(const QString &fileName)
+        : fileName(fileName)
+    {}
+
+private:
+    ASEFModel *make() const
     {
+        ASEFModel *model = new ASEFModel();
         QFile file;
         QByteArray line, lf, rf, magic_number;
         QList<QByteArray> words;
@@ -68,11 +95,11 @@ public:
         Scalar t1, t2;
 
         // Open the eye locator model
-        file.setFileName(Globals->sdkPath + "/share/openbr/models/EyeLocatorASEF128x128.fel");
-        bool success = file.open(QFile::ReadOnly); if (!success) qFatal("ASEFEyes::ASEFEyes failed to open %s for reading.", qPrintable(file.fileName()));
+        file.setFileName(fileName);
+        bool success = file.open(QFile::ReadOnly); if (!success) qFatal("ASEFModelMaker::make failed to open %s for reading.", qPrintable(file.fileName()));
 
         // Check the first line
-        line = file.readLine().simplified(); if (line != "CFEL") qFatal("ASEFEyes::ASEFEyes invalid header.");
+        line = file.readLine().simplified(); if (line != "CFEL") qFatal("ASEFModelMaker::make invalid header.");
 
         // Read past the comment and copyright.
         file.readLine();
@@ -85,11 +112,11 @@ public:
 
         // Read in the left bounding rectangle
         words = file.readLine().simplified().split(' ');
-        left_rect = Rect(words[0].toInt(), words[1].toInt(), words[2].toInt(), words[3].toInt());
+        model->left_rect = Rect(words[0].toInt(), words[1].toInt(), words[2].toInt(), words[3].toInt());
 
         // Read in the right bounding rectangle
         words = file.readLine().simplified().split(' ');
-        right_rect = Rect(words[0].toInt(), words[1].toInt(), words[2].toInt(), words[3].toInt());
+        model->right_rect = Rect(words[0].toInt(), words[1].toInt(), words[2].toInt(), words[3].toInt());
 
         // Read the magic number
         magic_number = file.readLine().simplified();
@@ -122,67 +149,213 @@ public:
         right_mat.convertTo(right_filter, -1, 1.0/t2[0], -t1[0]*1.0/t2[0]);
 
         // Check the input to this function
-        height = left_filter.rows;
-        width = left_filter.cols;
+        model->height = left_filter.rows;
+        model->width = left_filter.cols;
         assert((left_filter.rows == right_filter.rows) &&
                (left_filter.cols == right_filter.cols) &&
                (left_filter.channels() == 1) &&
                (right_filter.channels() == 1));
 
-        // Create the arrays needed for the computation
-        left_filter_dft  = Mat(r, c, CV_32F);
-        right_filter_dft = Mat(r, c, CV_32F);
-
         // Compute the filters in the Fourier domain
-        dft(left_filter, left_filter_dft, CV_DXT_FORWARD);
-        dft(right_filter, right_filter_dft, CV_DXT_FORWARD);
+        Mat left_filter_dft, right_filter_dft;
+        dft(left_filter, left_filter_dft, DFT_COMPLEX_OUTPUT);
+        dft(right_filter, right_filter_dft, DFT_COMPLEX_OUTPUT);
+
+        // Combine them so the left correlation is the real part and the right correlation the imaginary part
+        Mat filters_dft(r, c, CV_32FC2);
+        for (int i=0; i<r; i++)
+            for (int j=0; j<c; j++) {
+                const Vec2f &left = left_filter_dft.at<Vec2f>(i, j);
+                const Vec2f &right = right_filter_dft.at<Vec2f>(i, j);
+                filters_dft.at<Vec2f>(i, j) = Vec2f(left[0] + right[1], right[0] - left[1]);
+            }
+
+        // The image spectrum is multiplied after the column pass, when it is transposed
+        transpose(filters_dft, model->filters_dft);
 
         // Create the look up table for the log transform
-        lut = Mat(256, 1, CV_32F);
-        for (int i=0; i<256; i++) lut.at<float>(i, 0) = std::log((float)i+1);
+        model->lut = Mat(256, 1, CV_32F);
+        for (int i=0; i<256; i++) model->lut.at<float>(i, 0) = std::log((float)i+1);
+
+        return model;
     }
+};
 
-private:
-    void project(const Template &src, Template &dst) const
+/*!
+ * \ingroup transforms
+ * \brief Bolme, D.S.; Draper, B.A.; Beveridge, J.R.;
+ * "Average of Synthetic Exact Filters,"
+ * Computer Vision and Pattern Recognition, 2009. CVPR 2009.
+ * IEEE Conference on , vol., no., pp.2105-2112, 20-25 June 2009
+ * \author David Bolme
+ * \author Josh Klontz \cite jklontz
+ */
+class ASEFEyes : public UntrainableTransform
+{
+    Q_OBJECT
+
+    QSharedPointer<const ASEFModel> model;
+
+public:
+    ASEFEyes()
     {
-        Rect roi = OpenCVUtils::toRect(src.file.ROIs().first());
+        const QString fileName = Globals->sdkPath + "/share/openbr/models/EyeLocatorASEF128x128.fel";
+        model = ResourceRegistry<ASEFModel>::get(fileName, ASEFModelMaker(fileName));
+    }
 
-        Mat gray;
-        OpenCVUtils::cvtGray(src.m()(roi), gray);
+private:
+    enum { BatchSize = 16 }; // Faces per FFT pass
 
-        Mat image_tile;
-        // (r,c) == (128, 128) EyeLocatorASEF128x128.fel
-        resize(gray, image_tile, Size(height, width));
+    static ASEFWorkspace &workspace()
+    {
+        static QThreadStorage<ASEFWorkspace*> *workspaces = new QThreadStorage<ASEFWorkspace*>();
+        if (!workspaces->hasLocalData()) workspaces->setLocalData(new ASEFWorkspace());
+        return *workspaces->localData();
+    }
 
-        // _preprocess
-        Mat image;
-        LUT(image_tile, lut, image);
+    // Location of the largest value of one channel in the window
+    static Point peak(const Mat &m, const Rect &window, int channel)
+    {
+        Point location(0, 0);
+        float best = -std::numeric_limits<float>::max();
+        for (int i=0; i<window.height; i++) {
+            const Vec2f *row = m.ptr<Vec2f>(window.y+i) + window.x;
+            for (int j=0; j<window.width; j++)
+                if (row[j][channel] > best) {
+                    best = row[j][channel];
+                    location = Point(j, i);
+                }
+        }
+        return location;
+    }
+
+    static void _locate(const ASEFEyes *eyes, const Template *const *src, Template *const *dst, int count)
+    {
+        MatrixAllocatorScope scope;
+        eyes->locate(src, dst, count);
+    }
 
-        // correlate
-        Mat left_corr, right_corr;
-        dft(image, image, CV_DXT_FORWARD);
-        mulSpectrums(image, left_filter_dft, left_corr, 0, true);
-        mulSpectrums(image, right_filter_dft, right_corr, 0, true);
-        dft(left_corr, left_corr, CV_DXT_INV_SCALE);
-        dft(right_corr, right_corr, CV_DXT_INV_SCALE);
+    void locate(const Template *const *src, Template *const *dst, int count) const
+    {
+        const Rect &left_rect = model->left_rect;
+        const Rect &right_rect = model->right_rect;
+        const int width = model->width;
+        const int height = model->height;
+
+        // Only the rows spanned by the search windows are transformed back
+        const int top = std::min(left_rect.y, right_rect.y);
+        const int rows = std::max(left_rect.y + left_rect.height, right_rect.y + right_rect.height) - top;
+
+        ASEFWorkspace &w = workspace();
+        Mat tiles = ASEFWorkspace::reserve(w.tiles, count*height, width, CV_32FC1);
+
+        // _preprocess, templates that fail are marked FTE as in Transform::project() and left out of the batch
+        QVector<int> indices; indices.reserve(count);
+        QVector<Rect> rois; rois.reserve(count);
+        QVector<Size> sizes; sizes.reserve(count);
+        for (int i=0; i<count; i++) {
+            try {
+                const QList<QRectF> ROIs = src[i]->file.ROIs();
+                CV_Assert(!ROIs.isEmpty());
+                const Rect roi = OpenCVUtils::toRect(ROIs.first());
+
+                Mat gray;
+                gray.allocator = matrixAllocator();
+                OpenCVUtils::cvtGray(src[i]->m()(roi), gray);
+
+                // (r,c) == (128, 128) EyeLocatorASEF128x128.fel
+                resize(gray, w.tile, Size(width, height));
+                Mat image = tiles.rowRange(indices.size()*height, (indices.size()+1)*height);
+                LUT(w.tile, model->lut, image);
+
+                indices.append(i);
+                rois.append(roi);
+                sizes.append(gray.size());
+            } catch (...) {
+                qWarning("Exception triggered when processing %s with transform %s", qPrintable(src[i]->file.flat()), qPrintable(name()));
+                *dst[i] = Template(src[i]->file);
+                dst[i]->file.setBool("FTE");
+            }
+        }
+        count = indices.size();
+        if (count == 0) return;
+
+        Mat spectrum = ASEFWorkspace::reserve(w.spectrum, count*height, width, CV_32FC2);
+        Mat columns = ASEFWorkspace::reserve(w.columns, count*width, height, CV_32FC2);
+        Mat windows = ASEFWorkspace::reserve(w.windows, count*rows, width, CV_32FC2);
+
+        // correlate, each pass transforms every tile in the batch at once
+        dft(tiles.rowRange(0, count*height), spectrum, DFT_ROWS | DFT_COMPLEX_OUTPUT);
+        for (int i=0; i<count; i++) {
+            Mat tile = columns.rowRange(i*width, (i+1)*width);
+            transpose(spectrum.rowRange(i*height, (i+1)*height), tile);
+        }
+        dft(columns, columns, DFT_ROWS);
+        for (int i=0; i<count; i++) {
+            Mat tile = columns.rowRange(i*width, (i+1)*width);
+            mulSpectrums(tile, model->filters_dft, tile, 0);
+        }
+        dft(columns, columns, DFT_INVERSE | DFT_ROWS);
+        for (int i=0; i<count; i++) {
+            Mat window = windows.rowRange(i*rows, (i+1)*rows);
+            transpose(columns.rowRange(i*width, (i+1)*width).colRange(top, top+rows), window);
+        }
+        dft(windows, windows, DFT_INVERSE | DFT_ROWS); // Unscaled, which doesn't move the peaks
 
         // locateEyes
-        double minVal, maxVal;
-        Point minLoc, maxLoc;
-
-        // left_rect == (23, 35)  (32, 32) EyeLocatorASEF128x128.fel
-        minMaxLoc(left_corr(left_rect), &minVal, &maxVal, &minLoc, &maxLoc);
-        float first_eye_x = (left_rect.x + maxLoc.x)*gray.cols/width+roi.x;
-        float first_eye_y = (left_rect.y + maxLoc.y)*gray.rows/height+roi.y;
-
-        // right_rect == (71, 32)  (32, 32) EyeLocatorASEF128x128.fel
-        minMaxLoc(right_corr(right_rect), &minVal, &maxVal, &minLoc, &maxLoc);
-        float second_eye_x = (right_rect.x + maxLoc.x)*gray.cols/width+roi.x;
-        float second_eye_y = (right_rect.y + maxLoc.y)*gray.rows/height+roi.y;
-
-        dst = src;
-        dst.file.appendLandmark(QPointF(first_eye_x, first_eye_y));
-        dst.file.appendLandmark(QPointF(second_eye_x, second_eye_y));
+        for (int i=0; i<count; i++) {
+            const Mat corr = windows.rowRange(i*rows, (i+1)*rows);
+            const Rect &roi = rois[i];
+            const Size &size = sizes[i];
+
+            // left_rect == (23, 35)  (32, 32) EyeLocatorASEF128x128.fel
+            const Point left = peak(corr, left_rect - Point(0, top), 0);
+            float first_eye_x = (left_rect.x + left.x)*size.width/width+roi.x;
+            float first_eye_y = (left_rect.y + left.y)*size.height/height+roi.y;
+
+            // right_rect == (71, 32)  (32, 32) EyeLocatorASEF128x128.fel
+            const Point right = peak(corr, right_rect - Point(0, top), 1);
+            float second_eye_x = (right_rect.x + right.x)*size.width/width+roi.x;
+            float second_eye_y = (right_rect.y + right.y)*size.height/height+roi.y;
+
+            Template &t = *dst[indices[i]];
+            t = *src[indices[i]];
+            t.file.appendLandmark(QPointF(first_eye_x, first_eye_y));
+            t.file.appendLandmark(QPointF(second_eye_x, second_eye_y));
+        }
+    }
+
+    void project(const Template &src, Template &dst) const
+    {
+        const Template *source = &src;
+        Template *output = &dst;
+        locate(&source, &output, 1);
+    }
+
+    bool batched() const
+    {
+        return true;
+    }
+
+    void project(const TemplateList &src, TemplateList &dst) const
+    {
+        dst.reserve(src.size());
+        for (int i=0; i<src.size(); i++) dst.append(Template());
+
+        QVector<const Template*> sources; sources.reserve(src.size());
+        QVector<Template*> outputs; outputs.reserve(src.size());
+        for (int i=0; i<src.size(); i++) {
+            sources.append(&src[i]);
+            outputs.append(&dst[i]);
+        }
+
+        QList< QFuture<void> > futures;
+        for (int begin=0; begin<src.size(); begin+=BatchSize) {
+            const int count = std::min(int(BatchSize), src.size()-begin);
+            if (Globals->parallelism) futures.append(QtConcurrent::run(_locate, this, sources.constData()+begin, outputs.constData()+begin, count));
+            else                                                      _locate (this, sources.constData()+begin, outputs.constData()+begin, count);
+        }
+        if (Globals->parallelism) Globals->trackFutures(futures);
     }
 };
 
@@ -103,6 +103,7 @@ class DoG : public UntrainableTransform
     void project(const Template &src, Template &dst) const
     {
         Mat g0, g1;
+        g0.allocator = g1.allocator = matrixAllocator();
         GaussianBlur(src, g0, ksize0, 0);
         GaussianBlur(src, g1, ksize1, 0);
         subtract(g0, g1, dst);
@@ -158,11 +159,11 @@ class ContrastEq : public UntrainableTransform
         const int nRows = src.m().rows;
         const int nCols = src.m().cols;
         const float* p = (const float*)stage2.ptr();
-        Mat m(nRows, nCols, CV_32FC1);
+        Mat &m = dst.m();
+        m.create(nRows, nCols, CV_32FC1);
         for (int i=0; i<nRows; i++)
             for (int j=0; j<nCols; j++)
                 m.at<float>(i, j) = fast_tanh(p[i*nCols+j]);
-        dst = m;
     }
 };
 
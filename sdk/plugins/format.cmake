@@ -0,0 +1,10 @@
+set(BR_WITH_LIBJPEG OFF CACHE BOOL "Decode JPEG images with libjpeg, enabling reduced size decoding")
+
+if(${BR_WITH_LIBJPEG})
+  find_package(JPEG REQUIRED)
+  include_directories(${JPEG_INCLUDE_DIR})
+  add_definitions(-DBR_WITH_LIBJPEG)
+  set(BR_THIRDPARTY_LIBS ${BR_THIRDPARTY_LIBS} ${JPEG_LIBRARIES})
+endif()
+
+set(BR_THIRDPARTY_SRC ${BR_THIRDPARTY_SRC} plugins/format.cpp)
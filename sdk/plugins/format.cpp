@@ -19,7 +19,13 @@
 #include <QNetworkReply>
 #endif // BR_EMBEDDED
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <openbr_plugin.h>
+#ifdef BR_WITH_LIBJPEG
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#endif // BR_WITH_LIBJPEG
 
 using namespace br;
 using namespace cv;
@@ -67,9 +73,83 @@ class csvFormat : public Format
 
 BR_REGISTER(Format, csvFormat)
 
+#ifdef BR_WITH_LIBJPEG
+struct JPEGErrorManager
+{
+    jpeg_error_mgr manager;
+    jmp_buf setjmpBuffer;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo)
+{
+    longjmp(((JPEGErrorManager*)cinfo->err)->setjmpBuffer, 1);
+}
+
+static void jpegOutputMessage(j_common_ptr)
+{
+    // Corrupt data warnings are not worth reporting
+}
+
+/*!
+ * Decodes with the largest DCT scaling (1/1, 1/2, 1/4 or 1/8) that keeps the image at least as large as the size hints.
+ * Leaves \em dst empty if libjpeg can't handle the image.
+ */
+static void decodeJPEG(const uchar *data, qint64 size, bool gray, int minRows, int minColumns, int minSize, Mat &dst)
+{
+    jpeg_decompress_struct cinfo;
+    JPEGErrorManager error;
+    cinfo.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = jpegErrorExit;
+    error.manager.output_message = jpegOutputMessage;
+
+    if (setjmp(error.setjmpBuffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        dst.release();
+        return;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<uchar*>(data), size);
+    jpeg_read_header(&cinfo, TRUE);
+    if ((cinfo.jpeg_color_space == JCS_CMYK) || (cinfo.jpeg_color_space == JCS_YCCK)) {
+        jpeg_destroy_decompress(&cinfo);
+        return;
+    }
+
+    int denominator = 1;
+    if ((minRows > 0) || (minColumns > 0) || (minSize > 0)) {
+        for (denominator = 8; denominator > 1; denominator /= 2) {
+            const int rows = (cinfo.image_height + denominator - 1) / denominator;
+            const int columns = (cinfo.image_width + denominator - 1) / denominator;
+            if ((rows >= minRows) && (columns >= minColumns) && (std::max(rows, columns) >= minSize)) break;
+        }
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denominator;
+    cinfo.out_color_space = (gray || (cinfo.jpeg_color_space == JCS_GRAYSCALE)) ? JCS_GRAYSCALE : JCS_RGB;
+
+    jpeg_start_decompress(&cinfo);
+    dst.create(cinfo.output_height, cinfo.output_width, CV_8UC(cinfo.output_components));
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = dst.ptr(cinfo.output_scanline);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    // Match imread's channel layout
+    if      (dst.channels() == 3) cvtColor(dst, dst, CV_RGB2BGR);
+    else if (!gray)               cvtColor(dst, dst, CV_GRAY2BGR);
+}
+#endif // BR_WITH_LIBJPEG
+
 /*!
  * \ingroup formats
  * \brief Reads image files.
+ *
+ * Honors the decoding hints set by \ref OpenTransform "Open":
+ * \c gray decodes directly to a single channel, and when built with libjpeg
+ * \c minRows, \c minColumns and \c minSize allow JPEG images to be decoded at a reduced size.
  * \author Josh Klontz \cite jklontz
  */
 class DefaultFormat : public Format
@@ -79,6 +159,7 @@ class DefaultFormat : public Format
     QList<Mat> read() const
     {
         QList<Mat> mats;
+        const int flags = file.getBool("gray") ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR;
 
         if (file.name.startsWith("http://") || file.name.startsWith("www.")) {
 #ifndef BR_EMBEDDED
@@ -93,13 +174,28 @@ class DefaultFormat : public Format
             QByteArray data = reply->readAll();
             delete reply;
 
-            Mat m = imdecode(Mat(1, data.size(), CV_8UC1, data.data()), 1);
+            Mat m = imdecode(Mat(1, data.size(), CV_8UC1, data.data()), flags);
             if (m.data) mats.append(m);
 #endif // BR_EMBEDDED
         } else {
             QString prefix = "";
             if (!QFileInfo(file.name).exists()) prefix = file.getString("path") + "/";
-            Mat m = imread((prefix+file.name).toStdString());
+
+            // Decode straight from the page cache instead of copying the file into memory
+            QFile f(prefix+file.name);
+            uchar *data = f.open(QFile::ReadOnly) ? f.map(0, f.size()) : NULL;
+            Mat m;
+            if (data) {
+#ifdef BR_WITH_LIBJPEG
+                if ((f.size() > 2) && (data[0] == 0xFF) && (data[1] == 0xD8)) // JPEG start of image marker
+                    decodeJPEG(data, f.size(), flags == CV_LOAD_IMAGE_GRAYSCALE,
+                               file.getInt("minRows", -1), file.getInt("minColumns", -1), file.getInt("minSize", -1), m);
+#endif // BR_WITH_LIBJPEG
+                if (!m.data) m = imdecode(Mat(1, f.size(), CV_8UC1, data), flags);
+                f.unmap(data);
+            } else {
+                m = imread((prefix+file.name).toStdString(), flags);
+            }
             if (m.data) mats.append(m);
         }
 
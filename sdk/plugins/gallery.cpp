@@ -22,6 +22,13 @@
 #include <QSqlQuery>
 #include <QSqlRecord>
 #endif // BR_EMBEDDED
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+#include <QXmlStreamReader>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <openbr_plugin.h>
 
 #include "core/bee.h"
@@ -30,16 +37,6 @@
 
 using namespace br;
 
-QDataStream &operator<<(QDataStream &stream, const Template &t)
-{
-    return stream << static_cast<const QList<cv::Mat>&>(t) << t.file;
-}
-
-QDataStream &operator>>(QDataStream &stream, Template &t)
-{
-    return stream >> static_cast<QList<cv::Mat>&>(t) >> t.file;
-}
-
 /*!
  * \ingroup galleries
  * \brief A binary gallery.
@@ -98,6 +95,16 @@ class galGallery : public Gallery
     {
         stream << t;
     }
+
+    qint64 position()
+    {
+        return gallery.pos();
+    }
+
+    void seek(qint64 position)
+    {
+        gallery.seek(position);
+    }
 };
 
 BR_REGISTER(Gallery, galGallery)
@@ -256,10 +263,20 @@ class memGallery : public Gallery
 
         TemplateList templates = MemoryGalleries::galleries[file].mid(block*Globals->blockSize, Globals->blockSize);
         *done = (templates.size() < Globals->blockSize);
-        block = done ? 0 : block+1;
+        block = *done ? 0 : block+1;
         return templates;
     }
 
+    qint64 position()
+    {
+        return block;
+    }
+
+    void seek(qint64 position)
+    {
+        block = position;
+    }
+
     void write(const Template &t)
     {
         MemoryGalleries::galleries[file].append(t);
@@ -297,6 +314,77 @@ class memGallery : public Gallery
 
 BR_REGISTER(Gallery, memGallery)
 
+/*!
+ * \brief Reads the lines of a text file without loading it.
+ *
+ * Lines are split and simplified as in QtUtils::readLines(), skipping empty ones.
+ * The file is memory mapped, falling back to reading it whole if it can't be.
+ */
+class LineReader
+{
+    QFile file;
+    QByteArray buffer;
+    const char *data;
+    qint64 size, position;
+
+public:
+    LineReader() : data(NULL), size(0), position(0) {}
+
+    bool isOpen() const
+    {
+        return file.isOpen();
+    }
+
+    void open(const QString &fileName)
+    {
+        file.setFileName(fileName);
+        if (!file.open(QFile::ReadOnly)) qFatal("LineReader::open unable to open %s for reading.", qPrintable(fileName));
+        size = file.size();
+        data = (size > 0) ? (const char*) file.map(0, size) : NULL;
+        if ((data == NULL) && (size > 0)) {
+            buffer = file.readAll();
+            data = buffer.constData();
+            size = buffer.size();
+        }
+        position = 0;
+    }
+
+    void close()
+    {
+        file.close(); // Also unmaps
+        buffer.clear();
+        data = NULL;
+        size = position = 0;
+    }
+
+    void rewind()
+    {
+        position = 0;
+    }
+
+    bool atStart() const
+    {
+        return position == 0;
+    }
+
+    bool atEnd()
+    {
+        while ((position < size) && (data[position] == '\n')) position++;
+        return position >= size;
+    }
+
+    bool readLine(QString &line)
+    {
+        if (atEnd()) return false;
+        const char *begin = data + position;
+        const char *end = (const char*) memchr(begin, '\n', size - position);
+        const qint64 length = end ? end - begin : size - position;
+        line = QString::fromAscii(begin, int(length)).simplified();
+        position += length;
+        return true;
+    }
+};
+
 /*!
  * \ingroup galleries
  * \brief Treats each line as a file.
@@ -315,6 +403,7 @@ class csvGallery : public Gallery
     BR_PROPERTY(int, fileIndex, 0)
 
     FileList files;
+    LineReader reader;
 
     bool isUniversal() const
     {
@@ -323,6 +412,7 @@ class csvGallery : public Gallery
 
     ~csvGallery()
     {
+        reader.close();
         if (files.isEmpty()) return;
 
         QStringList keys;
@@ -345,17 +435,21 @@ class csvGallery : public Gallery
     {
         *done = true;
         TemplateList templates;
-        if (!file.exists()) return templates;
-
-        QStringList lines = QtUtils::readLines(file);
-        if (!lines.isEmpty()) lines.removeFirst(); // Remove header
+        if (!reader.isOpen()) {
+            if (!file.exists()) return templates;
+            reader.open(file);
+        }
 
-        foreach (const QString &line, lines) {
+        QString line;
+        if (reader.atStart()) reader.readLine(line); // Remove header
+        while ((templates.size() < Globals->blockSize) && reader.readLine(line)) {
             QStringList words = line.split(',');
             if (words.isEmpty()) continue;
             templates.append(File(words[fileIndex], words.size() > 1 ? words.takeLast() : ""));
         }
 
+        *done = reader.atEnd();
+        if (*done) reader.rewind();
         return templates;
     }
 
@@ -381,9 +475,11 @@ class txtGallery : public Gallery
     Q_OBJECT
 
     QStringList lines;
+    LineReader reader;
 
     ~txtGallery()
     {
+        reader.close();
         if (!lines.isEmpty()) QtUtils::writeFile(file.name, lines);
     }
 
@@ -396,11 +492,17 @@ class txtGallery : public Gallery
     {
         *done = true;
         TemplateList templates;
-        if (!file.exists()) return templates;
+        if (!reader.isOpen()) {
+            if (!file.exists()) return templates;
+            reader.open(file);
+        }
 
-        foreach (const QString &line, QtUtils::readLines(file))
+        QString line;
+        while ((templates.size() < Globals->blockSize) && reader.readLine(line))
             templates.append(File(line));
-        *done = true;
+
+        *done = reader.atEnd();
+        if (*done) reader.rewind();
         return templates;
     }
 
@@ -416,6 +518,8 @@ BR_REGISTER(Gallery, txtGallery)
  * \ingroup galleries
  * \brief A \ref sigset input.
  * \author Josh Klontz \cite jklontz
+ *
+ * Parsed incrementally, one block of signatures at a time.
  */
 class xmlGallery : public Gallery
 {
@@ -423,17 +527,62 @@ class xmlGallery : public Gallery
     Q_PROPERTY(bool ignoreMetadata READ get_ignoreMetadata WRITE set_ignoreMetadata RESET reset_ignoreMetadata)
     BR_PROPERTY(bool, ignoreMetadata, false)
 
+    QFile sigset;
+    QXmlStreamReader reader;
+    QString subject;
+    int depth;
+
     bool isUniversal() const
     {
         return false;
     }
 
+    void rewind()
+    {
+        sigset.seek(0);
+        reader.clear();
+        reader.setDevice(&sigset);
+        subject.clear();
+        depth = 0;
+    }
+
     TemplateList readBlock(bool *done)
     {
+        if (!sigset.isOpen()) {
+            sigset.setFileName(file.name);
+            if (!sigset.open(QFile::ReadOnly)) qFatal("xmlGallery::readBlock unable to open %s for reading.", qPrintable(file.name));
+            rewind();
+        }
+
         TemplateList templates;
-        foreach (const File &signature, BEE::readSigset(file.name, ignoreMetadata))
-            templates.append(signature);
-        *done = true;
+        *done = false;
+        while (templates.size() < Globals->blockSize) {
+            const QXmlStreamReader::TokenType token = reader.readNext();
+            if (token == QXmlStreamReader::StartElement) {
+                depth++;
+                const QXmlStreamAttributes attributes = reader.attributes();
+                if (depth == 2) {
+                    // Subject
+                    subject = attributes.value("name").toString();
+                } else if (depth == 3) {
+                    // File
+                    File signature(attributes.value("file-name").toString(), subject);
+                    if (signature.isNull()) qFatal("xmlGallery::readBlock empty file-name in %s.", qPrintable(file.name));
+                    if (!ignoreMetadata)
+                        foreach (const QXmlStreamAttribute &attribute, attributes)
+                            if (attribute.name() != "file-name")
+                                signature.insert(attribute.name().toString(), attribute.value().toString());
+                    templates.append(signature);
+                }
+            } else if (token == QXmlStreamReader::EndElement) {
+                depth--;
+            } else if (reader.atEnd()) {
+                if (reader.hasError()) qFatal("xmlGallery::readBlock unable to parse %s: %s.", qPrintable(file.name), qPrintable(reader.errorString()));
+                *done = true;
+                rewind();
+                break;
+            }
+        }
         return templates;
     }
 
@@ -450,11 +599,40 @@ BR_REGISTER(Gallery, xmlGallery)
  * \ingroup galleries
  * \brief Database input.
  * \author Josh Klontz \cite jklontz
+ *
+ * Queries without a \c subset or filter column are stepped through with a cursor one block at a time.
+ * Rows are grouped by label in a temporary table so that SQLite, not the gallery, holds the result.
  */
 class dbGallery : public Gallery
 {
     Q_OBJECT
 
+#ifndef BR_EMBEDDED
+    QString connection;
+    QScopedPointer<QSqlQuery> cursor;
+    bool hasMetadata, hasRow, tableReady;
+    TemplateList selected; // Random subsets need every row, they are kept and returned in blocks
+    int position;
+#endif // BR_EMBEDDED
+
+    void init()
+    {
+#ifndef BR_EMBEDDED
+        tableReady = false;
+        position = -1;
+#endif // BR_EMBEDDED
+    }
+
+    ~dbGallery()
+    {
+#ifndef BR_EMBEDDED
+        if (connection.isEmpty()) return;
+        cursor.reset();
+        QSqlDatabase::database(connection, false).close();
+        QSqlDatabase::removeDatabase(connection);
+#endif // BR_EMBEDDED
+    }
+
     bool isUniversal() const
     {
         return false;
@@ -463,16 +641,43 @@ class dbGallery : public Gallery
     TemplateList readBlock(bool *done)
     {
         TemplateList templates;
-        br::File import = file.getString("import", "");
-        QString query = file.getString("query");
-        QString subset = file.getString("subset", "");
+        *done = true;
+
+#ifndef BR_EMBEDDED
+        if (cursor.isNull() && (position < 0)) start();
+
+        if (!cursor.isNull()) {
+            while ((templates.size() < Globals->blockSize) && hasRow) {
+                templates.append(File(cursor->value(0).toString(), hasMetadata ? cursor->value(1).toString() : ""));
+                hasRow = cursor->next();
+            }
+            *done = !hasRow;
+            if (*done) cursor.reset();
+        } else {
+            templates = selected.mid(position, Globals->blockSize);
+            position += templates.size();
+            *done = (position >= selected.size());
+            if (*done) {
+                selected.clear();
+                position = -1;
+            }
+        }
+#endif // BR_EMBEDDED
+
+        return templates;
+    }
 
 #ifndef BR_EMBEDDED
-        static QSqlDatabase db;
-        if (!db.isValid()) db = QSqlDatabase::addDatabase("QSQLITE");
+    QSqlDatabase open()
+    {
+        if (!connection.isEmpty()) return QSqlDatabase::database(connection);
+
+        connection = QString("dbGallery%1").arg(quintptr(this));
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection);
         db.setDatabaseName(file);
         if (!db.open()) qFatal("Input::loadDatabase failed to open SQLite database %s.", qPrintable((QString)file));
 
+        br::File import = file.getString("import", "");
         if (!import.isNull()) {
             qDebug("Parsing %s", qPrintable((QString)import));
             QStringList lines = QtUtils::readLines(import);
@@ -511,15 +716,46 @@ class dbGallery : public Gallery
             if (!q.execBatch()) qFatal("Input::loadDatabase %s.", qPrintable(q.lastError().text()));
         }
 
-        QSqlQuery q(db);
+        return db;
+    }
+
+    void start()
+    {
+        QSqlDatabase db = open();
+        QString query = file.getString("query");
+        QString subset = file.getString("subset", "");
+
+        QScopedPointer<QSqlQuery> q(new QSqlQuery(db));
+        q->setForwardOnly(true);
         if (query.startsWith('\'') && query.endsWith('\''))
             query = query.mid(1, query.size()-2);
-        if (!q.exec(query))
-            qFatal("Input::loadDatabase %s.", qPrintable(q.lastError().text()));
-        if ((q.record().count() == 0) || (q.record().count() > 3))
-            qFatal("Input::loadDatabase query record expected one to three fields, got %d.", q.record().count());
-        const bool hasMetadata = (q.record().count() >= 2);
-        const bool hasFilter = (q.record().count() >= 3);
+        query = query.trimmed();
+        while (query.endsWith(';')) query.chop(1);
+        if (!q->exec(query))
+            qFatal("Input::loadDatabase %s.", qPrintable(q->lastError().text()));
+        if ((q->record().count() == 0) || (q->record().count() > 3))
+            qFatal("Input::loadDatabase query record expected one to three fields, got %d.", q->record().count());
+        hasMetadata = (q->record().count() >= 2);
+        const bool hasFilter = (q->record().count() >= 3);
+
+        if (subset.isEmpty() && !hasFilter) {
+            if (hasMetadata) {
+                // Labels in sorted order, rows within a label in query order
+                const QString label = q->record().fieldName(1);
+                if (!tableReady) {
+                    q->finish();
+                    if (!q->exec("DROP TABLE IF EXISTS temp.dbGallery") ||
+                        !q->exec("CREATE TEMP TABLE dbGallery AS " + query))
+                        qFatal("Input::loadDatabase %s.", qPrintable(q->lastError().text()));
+                    tableReady = true;
+                }
+                if (!q->exec(QString("SELECT * FROM temp.dbGallery ORDER BY CAST(\"%1\" AS TEXT), rowid").arg(label)))
+                    qFatal("Input::loadDatabase %s.", qPrintable(q->lastError().text()));
+            }
+            cursor.reset(q.take());
+            hasRow = cursor->next();
+            return;
+        }
 
         // subset = seed:subjectMaxSize:numSubjects:subjectMinSize or
         // subset = seed:{Metadata,...,Metadata}:numSubjects
@@ -544,12 +780,12 @@ class dbGallery : public Gallery
 
         typedef QPair<QString,QString> Entry; // QPair<File,Metadata>
         QHash<QString, QList<Entry> > entries; // QHash<Label, QList<Entry> >
-        while (q.next()) {
-            if (hasFilter && (seed >= 0) && (qHash(q.value(2).toString()) % 2 != (uint)seed % 2)) continue; // Ensures training and testing filters don't overlap
+        while (q->next()) {
+            if (hasFilter && (seed >= 0) && (qHash(q->value(2).toString()) % 2 != (uint)seed % 2)) continue; // Ensures training and testing filters don't overlap
             if (metadataFields.isEmpty())
-                entries[hasMetadata ? q.value(1).toString() : ""].append(QPair<QString,QString>(q.value(0).toString(), hasFilter ? q.value(2).toString() : ""));
+                entries[hasMetadata ? q->value(1).toString() : ""].append(QPair<QString,QString>(q->value(0).toString(), hasFilter ? q->value(2).toString() : ""));
             else
-                entries[hasFilter ? q.value(2).toString() : ""].append(QPair<QString,QString>(q.value(0).toString(), hasMetadata ? q.value(1).toString() : ""));
+                entries[hasFilter ? q->value(2).toString() : ""].append(QPair<QString,QString>(q->value(0).toString(), hasMetadata ? q->value(1).toString() : ""));
         }
 
         QStringList labels = entries.keys();
@@ -581,17 +817,14 @@ class dbGallery : public Gallery
                 if (entryList.size() > subjectMaxSize)
                     std::random_shuffle(entryList.begin(), entryList.end());
                 foreach (const Entry &entry, entryList.mid(0, subjectMaxSize))
-                    templates.append(File(entry.first, label));
+                    selected.append(File(entry.first, label));
                 numSubjects--;
             }
         }
 
-        db.close();
-#endif // BR_EMBEDDED
-
-        *done = true;
-        return templates;
+        position = 0;
     }
+#endif // BR_EMBEDDED
 
     void write(const Template &t)
     {
@@ -660,4 +893,209 @@ class googleGallery : public Gallery
 
 BR_REGISTER(Gallery, googleGallery)
 
+/*!
+ * \ingroup galleries
+ * \brief Reads the frames of a video file.
+ *
+ * Frames are decoded in a dedicated thread into a bounded queue and returned in blocks of br::Context::blockSize.
+ * Each template has the video file name with the frame index as \c Frame metadata.
+ * Only every \em stride-th frame is returned, skipped frames are grabbed but not converted.
+ *
+ * If \em detectEvery is positive, \em detector runs on every \em detectEvery-th returned frame
+ * and the detected ROIs are propagated to the frames in between by template matching,
+ * so the templates arrive with ROIs already set.
+ */
+class videoGallery : public Gallery
+{
+    Q_OBJECT
+    Q_PROPERTY(int stride READ get_stride WRITE set_stride RESET reset_stride STORED false)
+    Q_PROPERTY(int detectEvery READ get_detectEvery WRITE set_detectEvery RESET reset_detectEvery STORED false)
+    Q_PROPERTY(QString detector READ get_detector WRITE set_detector RESET reset_detector STORED false)
+    BR_PROPERTY(int, stride, 1)
+    BR_PROPERTY(int, detectEvery, 0)
+    BR_PROPERTY(QString, detector, "Cascade(FrontalFace)")
+
+    class Decoder : public QThread
+    {
+        videoGallery *gallery;
+
+    public:
+        Decoder(videoGallery *gallery)
+            : gallery(gallery)
+        {}
+
+    private:
+        void run()
+        {
+            gallery->decode();
+        }
+    };
+
+    QScopedPointer<Decoder> decoder;
+    QMutex mutex;
+    QWaitCondition notEmpty, notFull;
+    QQueue<Template> queue;
+    bool finished, stopped;
+
+public:
+    ~videoGallery()
+    {
+        stop();
+    }
+
+private:
+    void init()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        if (!decoder.isNull()) {
+            mutex.lock();
+            stopped = true;
+            notFull.wakeAll();
+            mutex.unlock();
+            decoder->wait();
+            decoder.reset();
+        }
+        queue.clear();
+        finished = stopped = false;
+    }
+
+    bool push(const Template &t)
+    {
+        QMutexLocker locker(&mutex);
+        while (!stopped && (queue.size() >= 2*std::max(1, Globals->blockSize)))
+            notFull.wait(&mutex);
+        if (stopped) return false;
+        queue.enqueue(t);
+        notEmpty.wakeAll();
+        return true;
+    }
+
+    static QList<cv::Rect> track(const cv::Mat &previous, const cv::Mat &current, const QList<cv::Rect> &ROIs)
+    {
+        QList<cv::Rect> tracked;
+        const cv::Rect bounds(0, 0, current.cols, current.rows);
+        foreach (cv::Rect ROI, ROIs) {
+            ROI &= bounds;
+            if (ROI.area() == 0) continue;
+
+            // Search half an ROI in every direction, at a resolution where the ROI is about 24 pixels wide
+            const cv::Rect search = cv::Rect(ROI.x - ROI.width/2, ROI.y - ROI.height/2, 2*ROI.width, 2*ROI.height) & bounds;
+            const double scale = std::min(1.0, 24.0 / ROI.width);
+            cv::Mat patch, window, result;
+            cv::resize(previous(ROI), patch, cv::Size(), scale, scale, cv::INTER_AREA);
+            cv::resize(current(search), window, cv::Size(), scale, scale, cv::INTER_AREA);
+            if ((window.rows < patch.rows) || (window.cols < patch.cols)) continue;
+
+            cv::matchTemplate(window, patch, result, CV_TM_CCOEFF_NORMED);
+            double score;
+            cv::Point best;
+            cv::minMaxLoc(result, NULL, &score, NULL, &best);
+            if (score < 0.5) continue; // Lost
+
+            tracked.append(cv::Rect(search.x + best.x/scale, search.y + best.y/scale, ROI.width, ROI.height) & bounds);
+        }
+        return tracked;
+    }
+
+    void decode()
+    {
+        cv::VideoCapture capture(file.name.toStdString());
+        if (!capture.isOpened()) qWarning("Can't open video %s", qPrintable(file.name));
+
+        QScopedPointer<Transform> detection;
+        if (detectEvery > 0) detection.reset(Transform::make(detector, NULL));
+
+        cv::Mat previous;
+        QList<cv::Rect> ROIs;
+        for (int frame=0, returned=0; capture.isOpened(); frame++) {
+            if (frame % std::max(1, stride) != 0) {
+                if (!capture.grab()) break;
+                continue;
+            }
+
+            cv::Mat m;
+            if (!capture.read(m)) break;
+            m = m.clone(); // VideoCapture reuses its buffer
+
+            File f(file.name);
+            f.insert("Frame", frame);
+            if (!detection.isNull()) {
+                cv::Mat gray;
+                OpenCVUtils::cvtGray(m, gray);
+                if (returned % detectEvery == 0) {
+                    Template detected;
+                    detection->project(Template(f, m), detected);
+                    ROIs = OpenCVUtils::toRects(detected.file.ROIs());
+                } else {
+                    ROIs = track(previous, gray, ROIs);
+                }
+                previous = gray;
+                f.setROIs(OpenCVUtils::fromRects(ROIs));
+            }
+
+            if (!push(Template(f, m))) break;
+            returned++;
+        }
+
+        QMutexLocker locker(&mutex);
+        finished = true;
+        notEmpty.wakeAll();
+    }
+
+    bool isUniversal() const
+    {
+        return false;
+    }
+
+    TemplateList readBlock(bool *done)
+    {
+        if (decoder.isNull()) {
+            decoder.reset(new Decoder(this));
+            decoder->start();
+        }
+
+        TemplateList templates;
+        {
+            QMutexLocker locker(&mutex);
+            while (templates.size() < Globals->blockSize) {
+                while (queue.isEmpty() && !finished)
+                    notEmpty.wait(&mutex);
+                if (queue.isEmpty()) break;
+                templates.append(queue.dequeue());
+                notFull.wakeAll();
+            }
+            *done = finished && queue.isEmpty();
+        }
+
+        // Start over on the next read
+        if (*done) stop();
+        return templates;
+    }
+
+    void write(const Template &t)
+    {
+        (void) t;
+        qFatal("Writing to a videoGallery not supported.");
+    }
+};
+
+BR_REGISTER(Gallery, videoGallery)
+
+class aviGallery : public videoGallery { Q_OBJECT };
+class mp4Gallery : public videoGallery { Q_OBJECT };
+class movGallery : public videoGallery { Q_OBJECT };
+class wmvGallery : public videoGallery { Q_OBJECT };
+class mpgGallery : public videoGallery { Q_OBJECT };
+class mkvGallery : public videoGallery { Q_OBJECT };
+BR_REGISTER(Gallery, aviGallery)
+BR_REGISTER(Gallery, mp4Gallery)
+BR_REGISTER(Gallery, movGallery)
+BR_REGISTER(Gallery, wmvGallery)
+BR_REGISTER(Gallery, mpgGallery)
+BR_REGISTER(Gallery, mkvGallery)
+
 #include "gallery.moc"
@@ -14,6 +14,10 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
 #include <opencv2/imgproc/imgproc.hpp>
 #include <openbr_plugin.h>
 
@@ -44,7 +48,9 @@ class Hist : public UntrainableTransform
 
         std::vector<Mat> mv;
         split(src, mv);
-        Mat m(mv.size(), dims, CV_32FC1);
+        Mat m;
+        m.allocator = matrixAllocator();
+        m.create(mv.size(), dims, CV_32FC1);
 
         for (size_t i=0; i<mv.size(); i++) {
             int channels[] = {0};
@@ -52,6 +58,7 @@ class Hist : public UntrainableTransform
             float range[] = {min, max};
             const float* ranges[] = {range};
             Mat hist;
+            hist.allocator = matrixAllocator();
             calcHist(&mv[i], 1, channels, Mat(), hist, 1, histSize, ranges);
             memcpy(m.ptr(i), hist.ptr(), dims * sizeof(float));
         }
@@ -62,6 +69,126 @@ class Hist : public UntrainableTransform
 
 BR_REGISTER(Transform, Hist)
 
+/*!
+ * \ingroup transforms
+ * \brief Histograms every rectangular subregion of the matrix in one pass.
+ *
+ * Equivalent to <tt>RectRegions(width,height,widthStep,heightStep)+Hist(max,min,dims)+Cat</tt>,
+ * without materializing the regions.
+ * Each value is quantized once and counted in every window that contains it, directly into the concatenated feature vector.
+ * With \em cat \c false each region's histogram is its own matrix, bit for bit the output of <tt>RectRegions+Hist</tt>,
+ * as in the \c FastDenseLBP abbreviation.
+ */
+class RegionHist : public UntrainableTransform
+{
+    Q_OBJECT
+    Q_PROPERTY(int width READ get_width WRITE set_width RESET reset_width STORED false)
+    Q_PROPERTY(int height READ get_height WRITE set_height RESET reset_height STORED false)
+    Q_PROPERTY(int widthStep READ get_widthStep WRITE set_widthStep RESET reset_widthStep STORED false)
+    Q_PROPERTY(int heightStep READ get_heightStep WRITE set_heightStep RESET reset_heightStep STORED false)
+    Q_PROPERTY(float max READ get_max WRITE set_max RESET reset_max STORED false)
+    Q_PROPERTY(float min READ get_min WRITE set_min RESET reset_min STORED false)
+    Q_PROPERTY(int dims READ get_dims WRITE set_dims RESET reset_dims STORED false)
+    Q_PROPERTY(bool cat READ get_cat WRITE set_cat RESET reset_cat STORED false)
+    BR_PROPERTY(int, width, 8)
+    BR_PROPERTY(int, height, 8)
+    BR_PROPERTY(int, widthStep, -1)
+    BR_PROPERTY(int, heightStep, -1)
+    BR_PROPERTY(float, max, 256)
+    BR_PROPERTY(float, min, 0)
+    BR_PROPERTY(int, dims, -1)
+    BR_PROPERTY(bool, cat, true) // If false each region's histogram is its own matrix, as RectRegions+Hist would produce
+
+    // Windows [begin, end) covering each position along one axis
+    static void windows(int size, int window, int step, int count, std::vector<int> &begin, std::vector<int> &end)
+    {
+        begin.resize(size);
+        end.resize(size);
+        for (int i=0; i<size; i++) {
+            begin[i] = std::max(0, (i - window + step) / step);
+            end[i] = std::min(count, i / step + 1);
+        }
+    }
+
+    void project(const Template &src, Template &dst) const
+    {
+        const int widthStep = this->widthStep == -1 ? width : this->widthStep;
+        const int heightStep = this->heightStep == -1 ? height : this->heightStep;
+        const int dims = this->dims == -1 ? max - min : this->dims;
+        const Mat &m = src;
+        const int channels = m.channels();
+        const int regionsX = m.cols < width ? 0 : (m.cols - width) / widthStep + 1;
+        const int regionsY = m.rows < height ? 0 : (m.rows - height) / heightStep + 1;
+
+        // Quantize once, with calcHist's uniform binning
+        const float scale = dims / (max - min), shift = -min * scale;
+        Mat bins;
+        bins.allocator = matrixAllocator();
+        bins.create(m.rows, m.cols * channels, CV_32SC1);
+        if (m.depth() == CV_8U) {
+            int lut[256];
+            for (int i=0; i<256; i++) {
+                const int bin = cvFloor(i * scale + shift);
+                lut[i] = (bin >= 0) && (bin < dims) ? bin : -1;
+            }
+            for (int i=0; i<m.rows; i++) {
+                const uchar *in = m.ptr<uchar>(i);
+                int *out = bins.ptr<int>(i);
+                for (int j=0; j<bins.cols; j++)
+                    out[j] = lut[in[j]];
+            }
+        } else {
+            Mat values;
+            values.allocator = matrixAllocator();
+            m.reshape(1, m.rows).convertTo(values, CV_32F);
+            for (int i=0; i<m.rows; i++) {
+                const float *in = values.ptr<float>(i);
+                int *out = bins.ptr<int>(i);
+                for (int j=0; j<bins.cols; j++) {
+                    const int bin = cvFloor(in[j] * scale + shift);
+                    out[j] = (bin >= 0) && (bin < dims) ? bin : -1;
+                }
+            }
+        }
+
+        std::vector<int> xBegin, xEnd, yBegin, yEnd;
+        windows(m.cols, width, widthStep, regionsX, xBegin, xEnd);
+        windows(m.rows, height, heightStep, regionsY, yBegin, yEnd);
+
+        // Regions in RectRegions order (x major), then channels, then bins
+        Mat hist;
+        hist.allocator = matrixAllocator();
+        hist.create(regionsX * regionsY * channels, dims, CV_32FC1);
+        hist = Scalar(0);
+        float *out = hist.ptr<float>();
+        const int regionStride = channels * dims;
+        for (int i=0; i<m.rows; i++) {
+            if (yBegin[i] >= yEnd[i]) continue;
+            const int *in = bins.ptr<int>(i);
+            for (int j=0; j<m.cols; j++) {
+                for (int c=0; c<channels; c++) {
+                    const int bin = in[j*channels+c];
+                    if (bin < 0) continue;
+                    for (int x=xBegin[j]; x<xEnd[j]; x++) {
+                        float *column = out + (x*regionsY)*regionStride + c*dims + bin;
+                        for (int y=yBegin[i]; y<yEnd[i]; y++)
+                            column[y*regionStride]++;
+                    }
+                }
+            }
+        }
+
+        if (cat) {
+            dst = hist.reshape(1, 1);
+        } else {
+            for (int i=0; i<regionsX*regionsY; i++)
+                dst += hist.rowRange(i*channels, (i+1)*channels);
+        }
+    }
+};
+
+BR_REGISTER(Transform, RegionHist)
+
 /*!
  * \ingroup transforms
  * \brief Converts each element to its rank-ordered value.
@@ -97,6 +224,9 @@ BR_REGISTER(Transform, Rank)
 /*!
  * \ingroup transforms
  * \brief An integral histogram
+ *
+ * Row \c i, columns <tt>[j*bins, (j+1)*bins)</tt> hold the histogram of the <tt>i*radius</tt> by <tt>j*radius</tt> pixels in the upper left corner.
+ * Pixel values are quantized uniformly into \em bins.
  * \author Josh Klontz \cite jklontz
  */
 class IntegralHist : public UntrainableTransform
@@ -107,21 +237,42 @@ class IntegralHist : public UntrainableTransform
     BR_PROPERTY(int, bins, 256)
     BR_PROPERTY(int, radius, 16)
 
+    // dst = a + b - c
+    static void combine(const qint32 *a, const qint32 *b, const qint32 *c, qint32 *dst, int size)
+    {
+        int i = 0;
+#ifdef __SSE2__
+        for (; i+4<=size; i+=4)
+            _mm_storeu_si128((__m128i*)(dst+i), _mm_sub_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(a+i)),
+                                                                            _mm_loadu_si128((const __m128i*)(b+i))),
+                                                              _mm_loadu_si128((const __m128i*)(c+i))));
+#endif // __SSE2__
+        for (; i<size; i++)
+            dst[i] = a[i] + b[i] - c[i];
+    }
+
     void project(const Template &src, Template &dst) const
     {
         const Mat &m = src.m();
         if (m.type() != CV_8UC1) qFatal("IntegralHist requires 8UC1 matrices.");
 
-        Mat integral(m.rows/radius+1, (m.cols/radius+1)*bins, CV_32SC1);
-        integral.setTo(0);
-        for (int i=1; i<integral.rows; i++) {
-            for (int j=1; j<integral.cols; j+=bins) {
-                for (int k=0; k<bins; k++) integral.at<qint32>(i, j+k) += integral.at<qint32>(i-1, j     +k);
-                for (int k=0; k<bins; k++) integral.at<qint32>(i, j+k) += integral.at<qint32>(i  , j-bins+k);
-                for (int k=0; k<bins; k++) integral.at<qint32>(i, j+k) -= integral.at<qint32>(i-1, j-bins+k);
-                for (int k=0; k<radius; k++)
+        int lut[256];
+        for (int i=0; i<256; i++)
+            lut[i] = i * bins / 256;
+
+        const int rows = m.rows/radius, cols = m.cols/radius;
+        Mat integral = Mat::zeros(rows+1, (cols+1)*bins, CV_32SC1);
+        for (int i=1; i<=rows; i++) {
+            const qint32 *above = integral.ptr<qint32>(i-1);
+            qint32 *row = integral.ptr<qint32>(i);
+            for (int j=1; j<=cols; j++) {
+                qint32 *cell = row + j*bins;
+                combine(above + j*bins, cell - bins, above + (j-1)*bins, cell, bins);
+                for (int k=0; k<radius; k++) {
+                    const uchar *pixels = m.ptr<uchar>((i-1)*radius+k) + (j-1)*radius;
                     for (int l=0; l<radius; l++)
-                        integral.at<qint32>(i, j+m.at<quint8>((i-1)*radius+k,(j/bins-1)*radius+l))++;
+                        cell[lut[pixels[l]]]++;
+                }
             }
         }
         dst = integral;
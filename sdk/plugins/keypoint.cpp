@@ -14,9 +14,16 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <QMutex>
+#include <QtConcurrentRun>
 #include <opencv2/features2d/features2d.hpp>
+#include <opencv2/flann/flann.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/nonfree/nonfree.hpp>
 #include <openbr_plugin.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif // __SSE__
 
 #include "core/opencvutils.h"
 
@@ -105,6 +112,14 @@ BR_REGISTER(Transform, KeyPointDescriptor)
 /*!
  * \ingroup transforms
  * \brief Wraps OpenCV Key Point Matcher
+ *
+ * \c BruteForce matching of floating point descriptors and \c BruteForce-Hamming matching of binary descriptors
+ * are computed directly from a full distance matrix, other matchers go through OpenCV.
+ * If \em approximate is \c true each target's descriptors are indexed
+ * with randomized kd-trees for floating point descriptors or LSH for binary descriptors,
+ * and every query is searched against the prebuilt indexes.
+ * Indexes are cached by target for the life of the distance, so a target gallery read once per query block is only indexed once,
+ * at the cost of keeping every compared target's descriptors and index in memory.
  * \author Josh Klontz \cite jklontz
  */
 class KeyPointMatcher : public Distance
@@ -112,11 +127,23 @@ class KeyPointMatcher : public Distance
     Q_OBJECT
     Q_PROPERTY(QString matcher READ get_matcher WRITE set_matcher RESET reset_matcher STORED false)
     Q_PROPERTY(float maxRatio READ get_maxRatio WRITE set_maxRatio RESET reset_maxRatio STORED false)
+    Q_PROPERTY(bool approximate READ get_approximate WRITE set_approximate RESET reset_approximate STORED false)
+    Q_PROPERTY(int checks READ get_checks WRITE set_checks RESET reset_checks STORED false)
     BR_PROPERTY(QString, matcher, "BruteForce")
     BR_PROPERTY(float, maxRatio, 0.8)
+    BR_PROPERTY(bool, approximate, false)
+    BR_PROPERTY(int, checks, 32)
 
     Ptr<DescriptorMatcher> descriptorMatcher;
 
+    struct CachedIndex
+    {
+        Mat descriptors; // The index refers to this data
+        QSharedPointer<flann::Index> index;
+    };
+    mutable QHash<QString, CachedIndex> indexes; // Keyed by br::File::flat() of the target
+    mutable QMutex indexesLock;
+
     void init()
     {
         descriptorMatcher = DescriptorMatcher::create(matcher.toStdString());
@@ -124,25 +151,192 @@ class KeyPointMatcher : public Distance
             qFatal("KeyPointMatcher::make failed to create DescriptorMatcher: %s", qPrintable(matcher));
     }
 
+    float similarity(std::vector<float> &distances) const
+    {
+        std::sort(distances.begin(), distances.end());
+        float similarity = 0;
+        for (size_t i=0; i<distances.size(); i++)
+            similarity += 1.f/(1+distances[i])/(i+1);
+        return similarity;
+    }
+
+    void ratioTest(float first, float second, std::vector<float> &distances) const
+    {
+        if (first / second > maxRatio) return;
+        distances.push_back(first);
+    }
+
+    static inline int popcount(quint64 x)
+    {
+#ifdef __GNUC__
+        return __builtin_popcountll(x);
+#else
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        return (x * 0x0101010101010101ULL) >> 56;
+#endif
+    }
+
+    static Mat hammingDistances(const Mat &a, const Mat &b)
+    {
+        const int bytes = a.cols;
+        const int words = bytes / 8;
+        Mat distances(a.rows, b.rows, CV_32FC1);
+        for (int i=0; i<a.rows; i++) {
+            const uchar *x = a.ptr(i);
+            float *row = distances.ptr<float>(i);
+            for (int j=0; j<b.rows; j++) {
+                const uchar *y = b.ptr(j);
+                int distance = 0;
+                for (int k=0; k<words; k++) {
+                    quint64 u, v;
+                    memcpy(&u, x+8*k, 8);
+                    memcpy(&v, y+8*k, 8);
+                    distance += popcount(u ^ v);
+                }
+                for (int k=8*words; k<bytes; k++)
+                    distance += popcount(x[k] ^ y[k]);
+                row[j] = distance;
+            }
+        }
+        return distances;
+    }
+
+    // |x-y| = sqrt(|x|^2 + |y|^2 - 2x.y), with the cross terms from one matrix product
+    static Mat l2Distances(const Mat &a, const Mat &b)
+    {
+        Mat aNorms, bNorms, distances;
+        reduce(a.mul(a), aNorms, 1, CV_REDUCE_SUM);
+        reduce(b.mul(b), bNorms, 1, CV_REDUCE_SUM);
+        gemm(a, b, -2, Mat(), 0, distances, GEMM_2_T);
+        for (int i=0; i<distances.rows; i++) {
+            float *row = distances.ptr<float>(i);
+            const float aNorm = aNorms.at<float>(i);
+            for (int j=0; j<distances.cols; j++)
+                row[j] = sqrt(std::max(row[j] + aNorm + bNorms.at<float>(j), 0.f));
+        }
+        return distances;
+    }
+
+    // Matches the smaller descriptor set against the larger one, as knnMatch was called
+    float exactCompare(const Mat &a, const Mat &b) const
+    {
+        Mat distances;
+        if ((matcher == "BruteForce") && (a.type() == CV_32FC1)) {
+            distances = l2Distances(a, b);
+        } else if ((matcher == "BruteForce-Hamming") && (a.type() == CV_8UC1)) {
+            distances = hammingDistances(a, b);
+        } else {
+            std::vector< std::vector<DMatch> > matches;
+            if (a.rows < b.rows) descriptorMatcher->knnMatch(a, b, matches, 2);
+            else                 descriptorMatcher->knnMatch(b, a, matches, 2);
+
+            std::vector<float> kept; kept.reserve(matches.size());
+            foreach (const std::vector<DMatch> &match, matches)
+                ratioTest(match[0].distance, match[1].distance, kept);
+            return similarity(kept);
+        }
+
+        if (a.rows >= b.rows) distances = distances.t();
+        std::vector<float> kept; kept.reserve(distances.rows);
+        for (int i=0; i<distances.rows; i++) {
+            const float *row = distances.ptr<float>(i);
+            float first = FLT_MAX, second = FLT_MAX;
+            for (int j=0; j<distances.cols; j++) {
+                if      (row[j] < first)  { second = first; first = row[j]; }
+                else if (row[j] < second) { second = row[j]; }
+            }
+            ratioTest(first, second, kept);
+        }
+        return similarity(kept);
+    }
+
+    QSharedPointer<flann::Index> buildIndex(const Mat &descriptors) const
+    {
+        if (descriptors.type() == CV_8UC1) return QSharedPointer<flann::Index>(new flann::Index(descriptors, flann::LshIndexParams(12, 20, 2), cvflann::FLANN_DIST_HAMMING));
+        else                               return QSharedPointer<flann::Index>(new flann::Index(descriptors, flann::KDTreeIndexParams(4)));
+    }
+
+    // The target's cached index, built if the target is new or its descriptors changed
+    QSharedPointer<flann::Index> index(const Template &target) const
+    {
+        const QString key = target.file.flat();
+        const Mat &descriptors = target.m();
+        {
+            QMutexLocker locker(&indexesLock);
+            const CachedIndex cached = indexes.value(key);
+            if (!cached.index.isNull() && (cached.descriptors.size() == descriptors.size()) && (cached.descriptors.type() == descriptors.type()) &&
+                (cached.descriptors.isContinuous() && descriptors.isContinuous()) &&
+                !memcmp(cached.descriptors.data, descriptors.data, descriptors.total() * descriptors.elemSize()))
+                return cached.index;
+        }
+
+        CachedIndex built;
+        built.descriptors = descriptors.clone();
+        built.index = buildIndex(built.descriptors);
+        QMutexLocker locker(&indexesLock);
+        indexes.insert(key, built);
+        return built.index;
+    }
+
+    float approximateCompare(flann::Index &index, const Mat &query) const
+    {
+        Mat indices, dists;
+        index.knnSearch(query, indices, dists, 2, flann::SearchParams(checks));
+
+        std::vector<float> kept; kept.reserve(query.rows);
+        const bool squared = query.type() != CV_8UC1; // FLANN reports squared L2 distances
+        for (int i=0; i<query.rows; i++) {
+            if (indices.at<int>(i, 1) < 0) continue; // LSH may find fewer than two neighbors
+            float first, second;
+            if (dists.type() == CV_32SC1) { first = dists.at<int>(i, 0); second = dists.at<int>(i, 1); }
+            else                          { first = dists.at<float>(i, 0); second = dists.at<float>(i, 1); }
+            if (squared) { first = sqrt(first); second = sqrt(second); }
+            ratioTest(first, second, kept);
+        }
+        return similarity(kept);
+    }
+
     float _compare(const Template &a, const Template &b) const
     {
         if ((a.m().rows < 2) || (b.m().rows < 2)) return 0;
+        if (!approximate) return exactCompare(a, b);
+        return approximateCompare(*index(a), b);
+    }
 
-        std::vector< std::vector<DMatch> > matches;
-        if (a.m().rows < b.m().rows) descriptorMatcher->knnMatch(a, b, matches, 2);
-        else                         descriptorMatcher->knnMatch(b, a, matches, 2);
+    void compare(const TemplateList &target, const TemplateList &query, Output *output) const
+    {
+        if (!approximate) {
+            Distance::compare(target, query, output);
+            return;
+        }
 
-        QList<float> distances;
-        foreach (const std::vector<DMatch> &match, matches) {
-            if (match[0].distance / match[1].distance > maxRatio) continue;
-            distances.append(match[0].distance);
+        // Split the targets only, so each target's index is looked up once
+        const int stepSize = ceil(float(target.size()) / float(std::max(1, abs(Globals->parallelism))));
+        QList< QFuture<void> > futures;
+        for (int i=0; i<target.size(); i+=stepSize) {
+            const TemplateList targets(target.mid(i, stepSize));
+            if (Globals->parallelism) futures.append(QtConcurrent::run(this, &KeyPointMatcher::compareTargets, targets, query, output, i));
+            else                                                                          compareTargets (targets, query, output, i);
         }
-        qSort(distances);
+        if (Globals->parallelism) Globals->trackFutures(futures);
+    }
 
-        float similarity = 0;
-        for (int i=0; i<distances.size(); i++)
-            similarity += 1.f/(1+distances[i])/(i+1);
-        return similarity;
+    void compareTargets(const TemplateList &target, const TemplateList &query, Output *output, int targetOffset) const
+    {
+        QList< QSharedPointer<flann::Index> > targetIndexes;
+        foreach (const Template &t, target)
+            targetIndexes.append(t.m().rows < 2 ? QSharedPointer<flann::Index>() : index(t));
+
+        const float scale = property("a").toFloat(), shift = property("b").toFloat();
+        for (int i=0; i<query.size(); i++) {
+            const Mat &descriptors = query[i].m();
+            for (int j=0; j<target.size(); j++) {
+                const float score = (targetIndexes[j].isNull() || (descriptors.rows < 2)) ? 0 : approximateCompare(*targetIndexes[j], descriptors);
+                output->setRelative(scale * (score - shift), i, j+targetOffset);
+            }
+        }
     }
 };
 
@@ -176,6 +370,184 @@ class SIFTDescriptor : public UntrainableTransform
 
 BR_REGISTER(Transform, SIFTDescriptor)
 
+/*!
+ * \ingroup transforms
+ * \brief SIFT descriptors of a fixed size at every landmark, computed densely.
+ *
+ * Approximates SIFTDescriptor for upright key points without building a scale space.
+ * Gradients are computed once per image and stored as orientation-binned magnitude maps,
+ * and each descriptor is accumulated from the maps with a precomputed table of spatial weights.
+ * Key points use an angle of 0 where OpenCV's SIFT uses 361 degrees, so descriptors differ slightly and
+ * models trained on SIFTDescriptor features must be retrained before switching, see app/examples/check_dense_sift.cpp.
+ * Output is never bit for bit that of SIFTDescriptor, it has the same layout (one 128 dimensional row per landmark, in order)
+ * and is closest for key points whose window lies inside the image, where neither implementation clips samples.
+ * Opt in with the \c FastDenseSIFT abbreviation in place of \c DenseSIFT.
+ */
+class DenseSIFTDescriptor : public UntrainableTransform
+{
+    Q_OBJECT
+    Q_PROPERTY(int size READ get_size WRITE set_size RESET reset_size STORED false)
+    BR_PROPERTY(int, size, 1)
+
+    enum { Width = 4, // Spatial bins per side
+           Bins = 8, // Orientation bins
+           PaddedWidth = Width + 2 };
+
+    struct Sample
+    {
+        int dx, dy; // Offset from the key point
+        int cell; // Top-left of the four padded cells the sample contributes to
+        float weights[4]; // Gaussian times bilinear weight for cell, cell+1, cell+PaddedWidth, cell+PaddedWidth+1
+    };
+
+    QVector<Sample> samples;
+
+    void init()
+    {
+        // Same window and weighting as OpenCV's calcSIFTDescriptor() for an upright key point with scale size/2
+        const float histWidth = 3 * size / 2.f;
+        const int radius = cvRound(histWidth * 1.4142135623730951f * (Width + 1) * 0.5f);
+        const float expScale = -1.f / (Width * Width * 0.5f);
+
+        samples.clear();
+        for (int i=-radius; i<=radius; i++) {
+            for (int j=-radius; j<=radius; j++) {
+                const float cRot = j / histWidth;
+                const float rRot = i / histWidth;
+                float rbin = rRot + Width/2 - 0.5f;
+                float cbin = cRot + Width/2 - 0.5f;
+                if ((rbin <= -1) || (rbin >= Width) || (cbin <= -1) || (cbin >= Width)) continue;
+
+                const float weight = exp((cRot*cRot + rRot*rRot) * expScale);
+                const int r0 = cvFloor(rbin);
+                const int c0 = cvFloor(cbin);
+                rbin -= r0;
+                cbin -= c0;
+
+                Sample sample;
+                sample.dx = j;
+                sample.dy = i;
+                sample.cell = (r0+1)*PaddedWidth + (c0+1);
+                sample.weights[0] = weight * (1-rbin) * (1-cbin);
+                sample.weights[1] = weight * (1-rbin) * cbin;
+                sample.weights[2] = weight * rbin * (1-cbin);
+                sample.weights[3] = weight * rbin * cbin;
+                samples.append(sample);
+            }
+        }
+    }
+
+    static inline void accumulate(float *hist, const float *bins, float weight)
+    {
+#ifdef __SSE__
+        const __m128 w = _mm_set1_ps(weight);
+        _mm_storeu_ps(hist,   _mm_add_ps(_mm_loadu_ps(hist),   _mm_mul_ps(w, _mm_loadu_ps(bins))));
+        _mm_storeu_ps(hist+4, _mm_add_ps(_mm_loadu_ps(hist+4), _mm_mul_ps(w, _mm_loadu_ps(bins+4))));
+#else
+        for (int i=0; i<Bins; i++)
+            hist[i] += weight * bins[i];
+#endif // __SSE__
+    }
+
+    static Mat orientationMaps(const Mat &src)
+    {
+        // SIFT's base image: gray, floating point, blurred from an assumed sigma of 0.5 to 1.6
+        Mat gray, image;
+        if (src.channels() == 1) gray = src;
+        else                     OpenCVUtils::cvtGray(src, gray);
+        gray.convertTo(image, CV_32F);
+        GaussianBlur(image, image, Size(), sqrtf(1.6f*1.6f - 0.5f*0.5f));
+
+        const int rows = image.rows;
+        const int cols = image.cols;
+        Mat dx(rows, cols, CV_32FC1, Scalar(0));
+        Mat dy(rows, cols, CV_32FC1, Scalar(0));
+        for (int r=1; r<rows-1; r++) {
+            const float *above = image.ptr<float>(r-1);
+            const float *row = image.ptr<float>(r);
+            const float *below = image.ptr<float>(r+1);
+            float *x = dx.ptr<float>(r);
+            float *y = dy.ptr<float>(r);
+            for (int c=1; c<cols-1; c++) {
+                x[c] = row[c+1] - row[c-1];
+                y[c] = above[c] - below[c];
+            }
+        }
+
+        Mat magnitude, orientation;
+        cartToPolar(dx, dy, magnitude, orientation, true);
+
+        // Interleaved so the Bins values of a pixel are contiguous, border pixels have zero magnitude
+        Mat maps(rows, cols*Bins, CV_32FC1, Scalar(0));
+        for (int r=0; r<rows; r++) {
+            const float *mag = magnitude.ptr<float>(r);
+            const float *ori = orientation.ptr<float>(r);
+            float *bins = maps.ptr<float>(r);
+            for (int c=0; c<cols; c++, bins+=Bins) {
+                const float obin = ori[c] * Bins / 360.f;
+                int o0 = cvFloor(obin);
+                const float fraction = obin - o0;
+                if (o0 < 0) o0 += Bins;
+                if (o0 >= Bins) o0 -= Bins;
+                bins[o0] = mag[c] * (1-fraction);
+                bins[(o0+1) % Bins] = mag[c] * fraction;
+            }
+        }
+        return maps;
+    }
+
+    void project(const Template &src, Template &dst) const
+    {
+        const Mat maps = orientationMaps(src);
+        const int rows = maps.rows;
+        const int cols = maps.cols / Bins;
+        const int length = Width * Width * Bins;
+
+        const QList<QPointF> landmarks = src.file.landmarks();
+        Mat m(landmarks.size(), length, CV_32FC1);
+        for (int k=0; k<landmarks.size(); k++) {
+            const int x = cvRound(landmarks[k].x());
+            const int y = cvRound(landmarks[k].y());
+
+            float hist[PaddedWidth*PaddedWidth*Bins];
+            memset(hist, 0, sizeof(hist));
+            foreach (const Sample &sample, samples) {
+                const int r = y + sample.dy;
+                const int c = x + sample.dx;
+                if ((r <= 0) || (r >= rows-1) || (c <= 0) || (c >= cols-1)) continue;
+                const float *bins = maps.ptr<float>(r) + c*Bins;
+                float *cell = hist + sample.cell*Bins;
+                accumulate(cell,                        bins, sample.weights[0]);
+                accumulate(cell + Bins,                 bins, sample.weights[1]);
+                accumulate(cell + PaddedWidth*Bins,     bins, sample.weights[2]);
+                accumulate(cell + (PaddedWidth+1)*Bins, bins, sample.weights[3]);
+            }
+
+            float *descriptor = m.ptr<float>(k);
+            for (int i=0; i<Width; i++)
+                for (int j=0; j<Width; j++)
+                    memcpy(descriptor + (i*Width + j)*Bins, hist + ((i+1)*PaddedWidth + (j+1))*Bins, Bins*sizeof(float));
+
+            // Clamp large gradients and normalize as SIFT does
+            float norm = 0;
+            for (int i=0; i<length; i++)
+                norm += descriptor[i] * descriptor[i];
+            const float threshold = sqrtf(norm) * 0.2f;
+            norm = 0;
+            for (int i=0; i<length; i++) {
+                descriptor[i] = std::min(descriptor[i], threshold);
+                norm += descriptor[i] * descriptor[i];
+            }
+            const float scale = 512.f / std::max(sqrtf(norm), FLT_EPSILON);
+            for (int i=0; i<length; i++)
+                descriptor[i] = saturate_cast<uchar>(descriptor[i] * scale);
+        }
+        dst += m;
+    }
+};
+
+BR_REGISTER(Transform, DenseSIFTDescriptor)
+
 /*!
  * \ingroup transforms
  * \brief Add landmarks to the template in a grid layout
@@ -16,6 +16,10 @@
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <limits>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
 #include <openbr_plugin.h>
 
 using namespace cv;
@@ -34,9 +38,11 @@ class LBP : public UntrainableTransform
     Q_PROPERTY(int radius READ get_radius WRITE set_radius RESET reset_radius STORED false)
     Q_PROPERTY(int maxTransitions READ get_maxTransitions WRITE set_maxTransitions RESET reset_maxTransitions STORED false)
     Q_PROPERTY(bool rotationInvariant READ get_rotationInvariant WRITE set_rotationInvariant RESET reset_rotationInvariant STORED false)
+    Q_PROPERTY(bool circular READ get_circular WRITE set_circular RESET reset_circular STORED false)
     BR_PROPERTY(int, radius, 1)
     BR_PROPERTY(int, maxTransitions, 8)
     BR_PROPERTY(bool, rotationInvariant, false)
+    BR_PROPERTY(bool, circular, false) // Sample the diagonal neighbors on the circle of the given radius instead of the square
 
     uchar lut[256];
     uchar null;
@@ -93,25 +99,113 @@ class LBP : public UntrainableTransform
                 lut[i] = null; // Set to null id
     }
 
+    // Neighbors in bit order, most significant first, offset to the first column with a full neighborhood
+    template <typename T>
+    void neighborhood(const Mat &m, int r, const T *neighbors[8]) const
+    {
+        const T *above = m.ptr<T>(r-radius) + radius, *row = m.ptr<T>(r) + radius, *below = m.ptr<T>(r+radius) + radius;
+        neighbors[0] = above - radius; neighbors[1] = above; neighbors[2] = above + radius;
+        neighbors[3] = row + radius;
+        neighbors[4] = below + radius; neighbors[5] = below; neighbors[6] = below - radius;
+        neighbors[7] = row - radius;
+    }
+
+    // Replaces the diagonal neighbors with bilinear samples on the circle of the given radius
+    void interpolate(const Mat &m, int r, int width, float *samples, const float *neighbors[8]) const
+    {
+        static const int diagonals[4][3] = { {0, -1, -1}, {2, -1, 1}, {4, 1, 1}, {6, 1, -1} }; // neighbor, y sign, x sign
+        const float d = radius / std::sqrt(2.f);
+        for (int q=0; q<4; q++) {
+            const float y = diagonals[q][1] * d, x = diagonals[q][2] * d;
+            const int y0 = cvFloor(y), x0 = cvFloor(x);
+            const float wy = y - y0, wx = x - x0;
+            const float w00 = (1-wy)*(1-wx), w01 = (1-wy)*wx, w10 = wy*(1-wx), w11 = wy*wx;
+            const float *p0 = m.ptr<float>(r+y0) + radius + x0, *p1 = m.ptr<float>(r+y0+1) + radius + x0;
+            float *out = samples + q*width;
+            for (int i=0; i<width; i++)
+                out[i] = w00*p0[i] + w01*p0[i+1] + w10*p1[i] + w11*p1[i+1];
+            neighbors[diagonals[q][0]] = out;
+        }
+    }
+
+    void encode(const uchar *center, const uchar *neighbors[8], int width, uchar *dst) const
+    {
+        int i = 0;
+#ifdef __SSE2__
+        // a >= b is max(a, b) == a for unsigned bytes
+        for (; i+16<=width; i+=16) {
+            const __m128i c = _mm_loadu_si128((const __m128i*)(center+i));
+            __m128i code = _mm_setzero_si128();
+            for (int k=0; k<8; k++) {
+                const __m128i v = _mm_loadu_si128((const __m128i*)(neighbors[k]+i));
+                code = _mm_or_si128(code, _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, c), v), _mm_set1_epi8(char(128>>k))));
+            }
+            uchar codes[16];
+            _mm_storeu_si128((__m128i*)codes, code);
+            for (int j=0; j<16; j++)
+                dst[i+j] = lut[codes[j]];
+        }
+#endif // __SSE2__
+        for (; i<width; i++) {
+            int code = 0;
+            for (int k=0; k<8; k++)
+                if (neighbors[k][i] >= center[i]) code |= 128>>k;
+            dst[i] = lut[code];
+        }
+    }
+
+    void encode(const float *center, const float *neighbors[8], int width, uchar *dst) const
+    {
+        int i = 0;
+#ifdef __SSE2__
+        for (; i+4<=width; i+=4) {
+            const __m128 c = _mm_loadu_ps(center+i);
+            __m128i code = _mm_setzero_si128();
+            for (int k=0; k<8; k++)
+                code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(_mm_cmpge_ps(_mm_loadu_ps(neighbors[k]+i), c)), _mm_set1_epi32(128>>k)));
+            int codes[4];
+            _mm_storeu_si128((__m128i*)codes, code);
+            for (int j=0; j<4; j++)
+                dst[i+j] = lut[codes[j]];
+        }
+#endif // __SSE2__
+        for (; i<width; i++) {
+            int code = 0;
+            for (int k=0; k<8; k++)
+                if (neighbors[k][i] >= center[i]) code |= 128>>k;
+            dst[i] = lut[code];
+        }
+    }
+
     void project(const Template &src, Template &dst) const
     {
-        Mat m; src.m().convertTo(m, CV_32F); assert(m.isContinuous() && (m.channels() == 1));
+        if (src.m().channels() != 1) qFatal("LBP::project expected single channel source.");
 
-        Mat n(m.rows, m.cols, CV_8UC1);
+        // Bytes are compared directly, everything else as floats
+        Mat m;
+        if ((src.m().depth() == CV_32F) || ((src.m().depth() == CV_8U) && !circular)) m = src.m();
+        else src.m().convertTo(m, CV_32F);
+
+        Mat n;
+        n.allocator = matrixAllocator();
+        n.create(m.rows, m.cols, CV_8UC1);
         n = null; // Initialize to NULL LBP pattern
 
-        const float *p = (const float*)m.ptr();
-        for (int r=radius; r<m.rows-radius; r++) {
-            for (int c=radius; c<m.cols-radius; c++) {
-                const float cval  =     (p[(r+0*radius)*m.cols+c+0*radius]);
-                n.at<uchar>(r, c) = lut[(p[(r-1*radius)*m.cols+c-1*radius] >= cval ? 128 : 0) |
-                                        (p[(r-1*radius)*m.cols+c+0*radius] >= cval ? 64  : 0) |
-                                        (p[(r-1*radius)*m.cols+c+1*radius] >= cval ? 32  : 0) |
-                                        (p[(r+0*radius)*m.cols+c+1*radius] >= cval ? 16  : 0) |
-                                        (p[(r+1*radius)*m.cols+c+1*radius] >= cval ? 8   : 0) |
-                                        (p[(r+1*radius)*m.cols+c+0*radius] >= cval ? 4   : 0) |
-                                        (p[(r+1*radius)*m.cols+c-1*radius] >= cval ? 2   : 0) |
-                                        (p[(r+0*radius)*m.cols+c-1*radius] >= cval ? 1   : 0)];
+        const int width = m.cols - 2*radius;
+        if (width > 0) {
+            std::vector<float> samples(circular ? 4*width : 0);
+            for (int r=radius; r<m.rows-radius; r++) {
+                uchar *out = n.ptr<uchar>(r) + radius;
+                if (m.depth() == CV_8U) {
+                    const uchar *p[8];
+                    neighborhood(m, r, p);
+                    encode(m.ptr<uchar>(r) + radius, p, width, out);
+                } else {
+                    const float *p[8];
+                    neighborhood(m, r, p);
+                    if (circular) interpolate(m, r, width, &samples[0], p);
+                    encode(m.ptr<float>(r) + radius, p, width, out);
+                }
             }
         }
 
@@ -139,51 +233,46 @@ class ColoredU2 : public UntrainableTransform
         return count;
     }
 
-    void project(const Template &src, Template &dst) const
+    Mat colors; // BGR color of each pattern
+
+    void init()
     {
-        static Mat hueLUT, saturationLUT, valueLUT;
-
-        if (!hueLUT.data) {
-            const int NUM_COLORS = 10;
-            hueLUT.create(1, 256, CV_8UC1);
-            hueLUT.setTo(0);
-
-            uchar uid = 0;
-            for (int i=0; i<256; i++) {
-                const int transitions = LBP::numTransitions(i);
-                int u2;
-                if   (transitions <= 2) u2 = uid++;
-                else                    u2 = 58;
-
-                // Assign hue based on bit count
-                int color = bitCount(i);
-                if (transitions > 2) color = NUM_COLORS-1;
-                hueLUT.at<uchar>(0, u2) = 255*color/NUM_COLORS;
-            }
+        const int NUM_COLORS = 10;
+        Mat hsv(1, 256, CV_8UC3, Scalar(0, 255, 255*3/4));
 
-            saturationLUT.create(1, 256, CV_8UC1);
-            saturationLUT.setTo(255);
+        uchar uid = 0;
+        for (int i=0; i<256; i++) {
+            const int transitions = LBP::numTransitions(i);
+            int u2;
+            if   (transitions <= 2) u2 = uid++;
+            else                    u2 = 58;
 
-            valueLUT.create(1, 256, CV_8UC1);
-            valueLUT.setTo(255*3/4);
+            // Assign hue based on bit count
+            int color = bitCount(i);
+            if (transitions > 2) color = NUM_COLORS-1;
+            hsv.at<Vec3b>(0, u2)[0] = 255*color/NUM_COLORS;
         }
 
+        cvtColor(hsv, colors, CV_HSV2BGR);
+    }
+
+    void project(const Template &src, Template &dst) const
+    {
         if (src.m().type() != CV_8UC1)
             qFatal("ColoredU2::project expected 8UC1 source type.");
 
-        Mat hue, saturation, value;
-        LUT(src, hueLUT, hue);
-        LUT(src, saturationLUT, saturation);
-        LUT(src, valueLUT, value);
-
-        std::vector<Mat> mv;
-        mv.push_back(hue);
-        mv.push_back(saturation);
-        mv.push_back(value);
-
+        const Mat &m = src;
         Mat coloredU2;
-        merge(mv, coloredU2);
-        cvtColor(coloredU2, dst, CV_HSV2BGR);
+        coloredU2.allocator = matrixAllocator();
+        coloredU2.create(m.rows, m.cols, CV_8UC3);
+        const Vec3b *table = colors.ptr<Vec3b>();
+        for (int i=0; i<m.rows; i++) {
+            const uchar *in = m.ptr<uchar>(i);
+            Vec3b *out = coloredU2.ptr<Vec3b>(i);
+            for (int j=0; j<m.cols; j++)
+                out[j] = table[in[j]];
+        }
+        dst = coloredU2;
     }
 };
 
@@ -32,11 +32,13 @@ class Mask : public UntrainableTransform
     void project(const Template &src, Template &dst) const
     {
         const Mat &m = src;
-        Mat mask(m.size(), CV_8UC1);
+        Mat mask;
+        mask.allocator = matrixAllocator();
+        mask.create(m.size(), CV_8UC1);
         mask.setTo(1);
         const float SCALE = 1.1;
         ellipse(mask, RotatedRect(Point2f(m.cols/2, m.rows/2), Size2f(SCALE*m.cols, SCALE*m.rows), 0), 0, -1);
-        dst = m.clone();
+        m.copyTo(dst.m());
         dst.m().setTo(0, mask);
     }
 };
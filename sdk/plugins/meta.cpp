@@ -18,6 +18,7 @@
 #include <openbr_plugin.h>
 
 #include "core/common.h"
+#include "core/model.h"
 #include "core/opencvutils.h"
 #include "core/qtutils.h"
 
@@ -58,6 +59,47 @@ static void _train(Transform *transform, const TemplateList *data)
     transform->train(*data);
 }
 
+static bool AnyTrainable(const QList<Transform*> &transforms)
+{
+    foreach (const Transform *transform, transforms)
+        if (transform->trainable()) return true;
+    return false;
+}
+
+static bool AnyBatched(const QList<Transform*> &transforms)
+{
+    foreach (const Transform *transform, transforms)
+        if (transform->batched()) return true;
+    return false;
+}
+
+// Blocks of a source projected through the leading transforms of a pipe or chain
+class ProjectedSource : public TemplateSource
+{
+    TemplateSource &source;
+    QList<Transform*> transforms;
+    bool simplify;
+
+public:
+    ProjectedSource(TemplateSource &source, const QList<Transform*> &transforms, bool simplify)
+        : source(source), transforms(transforms), simplify(simplify) {}
+
+    void rewind()
+    {
+        source.rewind();
+    }
+
+    bool read(TemplateList &block)
+    {
+        if (!source.read(block)) return false;
+        foreach (const Transform *f, transforms) {
+            block >> *f;
+            if (simplify) block = Simplified(block);
+        }
+        return true;
+    }
+};
+
 // For handling progress feedback
 static int depth = 0;
 
@@ -89,6 +131,10 @@ static void incrementStep()
  * \author Josh Klontz \cite jklontz
  *
  * The source br::Template is given to the first transform and the resulting br::Template is passed to the next transform, etc.
+ * A br::TemplateList is streamed one template at a time through the whole pipe, in parallel across templates.
+ * When br::Context::parallelism is negative, or a transform reports br::Transform::batched(),
+ * the list is instead passed through one transform at a time so batched transforms see every template at once.
+ * Each transform is then a synchronization point, and the intermediate templates of the whole list are held in memory.
  *
  * \see ChainTransform
  */
@@ -98,6 +144,17 @@ class PipeTransform : public MetaTransform
     Q_PROPERTY(QList<br::Transform*> transforms READ get_transforms WRITE set_transforms RESET reset_transforms)
     BR_PROPERTY(QList<br::Transform*>, transforms, QList<br::Transform*>())
 
+    void init()
+    {
+        // Tell each transform how much of its output the transforms that follow discard
+        for (int i=0; i<transforms.size()-1; i++) {
+            File hints;
+            for (int j=i+1; j<transforms.size(); j++)
+                if (!transforms[j]->decodeHints(hints)) break;
+            transforms[i]->setDecodeHints(hints);
+        }
+    }
+
     void train(const TemplateList &data)
     {
         acquireStep();
@@ -112,6 +169,27 @@ class PipeTransform : public MetaTransform
         releaseStep();
     }
 
+    bool trainable() const
+    {
+        return AnyTrainable(transforms);
+    }
+
+    // One or more passes per trainable transform, re-projecting each block instead of keeping intermediates
+    void streamTrain(TemplateSource &source)
+    {
+        acquireStep();
+
+        for (int i=0; i<transforms.size(); i++) {
+            if (transforms[i]->trainable()) {
+                ProjectedSource projected(source, transforms.mid(0, i), false);
+                transforms[i]->streamTrain(projected);
+            }
+            incrementStep();
+        }
+
+        releaseStep();
+    }
+
     void project(const Template &src, Template &dst) const
     {
         dst = src;
@@ -126,9 +204,14 @@ class PipeTransform : public MetaTransform
         }
     }
 
+    bool batched() const
+    {
+        return AnyBatched(transforms);
+    }
+
     void project(const TemplateList &src, TemplateList &dst) const
     {
-        if (Globals->parallelism < 0) {
+        if ((Globals->parallelism < 0) || batched()) {
             dst = src;
             foreach (const Transform *f, transforms)
                 dst >> *f;
@@ -171,6 +254,26 @@ class ChainTransform : public MetaTransform
         releaseStep();
     }
 
+    bool trainable() const
+    {
+        return AnyTrainable(transforms);
+    }
+
+    void streamTrain(TemplateSource &source)
+    {
+        acquireStep();
+
+        for (int i=0; i<transforms.size(); i++) {
+            if (transforms[i]->trainable()) {
+                ProjectedSource projected(source, transforms.mid(0, i), true);
+                transforms[i]->streamTrain(projected);
+            }
+            incrementStep();
+        }
+
+        releaseStep();
+    }
+
     void project(const Template &src, Template &dst) const
     {
         dst = src;
@@ -185,6 +288,11 @@ class ChainTransform : public MetaTransform
         }
     }
 
+    bool batched() const
+    {
+        return AnyBatched(transforms);
+    }
+
     void project(const TemplateList &src, TemplateList &dst) const
     {
         dst = src;
@@ -221,6 +329,18 @@ class ForkTransform : public MetaTransform
         if (threaded) Globals->trackFutures(futures);
     }
 
+    bool trainable() const
+    {
+        return AnyTrainable(transforms);
+    }
+
+    // The source is shared, so each branch makes its own pass over it in turn
+    void streamTrain(TemplateSource &source)
+    {
+        foreach (Transform *transform, transforms)
+            transform->streamTrain(source);
+    }
+
     void project(const Template &src, Template &dst) const
     {
         foreach (const Transform *f, transforms) {
@@ -234,9 +354,14 @@ class ForkTransform : public MetaTransform
         }
     }
 
+    bool batched() const
+    {
+        return AnyBatched(transforms);
+    }
+
     void project(const TemplateList &src, TemplateList &dst) const
     {
-        if (Globals->parallelism < 0) {
+        if ((Globals->parallelism < 0) || batched()) {
             dst.reserve(src.size());
             for (int i=0; i<src.size(); i++) dst.append(Template());
             foreach (const Transform *f, transforms) {
@@ -350,11 +475,16 @@ class LoadStoreTransform : public MetaTransform
         transform->train(data);
 
         qDebug("Storing %s", qPrintable(baseName));
-        QByteArray byteArray;
-        QDataStream stream(&byteArray, QFile::WriteOnly);
-        stream << description;
-        transform->store(stream);
-        QtUtils::writeFile(getFileName(), byteArray);
+        QByteArray descriptionData, transformData;
+        QDataStream descriptionStream(&descriptionData, QFile::WriteOnly);
+        QDataStream transformStream(&transformData, QFile::WriteOnly);
+        descriptionStream << description;
+        transform->store(transformStream);
+
+        QList<ModelFile::Section> sections;
+        sections.append(ModelFile::Section("description", descriptionData));
+        sections.append(ModelFile::Section("transform", transformData));
+        ModelFile::write(modelPath(), sections);
     }
 
     void project(const Template &src, Template &dst) const
@@ -367,9 +497,19 @@ class LoadStoreTransform : public MetaTransform
         transform->project(src, dst);
     }
 
+    bool batched() const
+    {
+        return transform->batched();
+    }
+
+    QString modelPath() const
+    {
+        return Globals->sdkPath + "/share/openbr/models/transforms/" + baseName;
+    }
+
     QString getFileName() const
     {
-        const QString file = Globals->sdkPath + "/share/openbr/models/transforms/" + baseName;
+        const QString file = modelPath();
         return QFileInfo(file).exists() ? file : QString();
     }
 
@@ -379,12 +519,21 @@ class LoadStoreTransform : public MetaTransform
         if (file.isEmpty()) return false;
 
         qDebug("Loading %s", qPrintable(baseName));
-        QByteArray data;
-        QtUtils::readFile(file, data);
-        QDataStream stream(&data, QFile::ReadOnly);
-        stream >> description;
+        ModelFile modelFile(file);
+        if (!modelFile.isSectioned()) {
+            // Legacy single compressed stream
+            QDataStream stream(modelFile.section(""));
+            stream >> description;
+            transform = Transform::make(description);
+            transform->load(stream);
+            return true;
+        }
+
+        QDataStream descriptionStream(modelFile.section("description"));
+        descriptionStream >> description;
         transform = Transform::make(description);
-        transform->load(stream);
+        QDataStream transformStream(modelFile.section("transform"));
+        transform->load(transformStream);
         return true;
     }
 };
@@ -25,17 +25,51 @@ using namespace br;
 /*!
  * \ingroup transforms
  * \brief Applies br::Format to br::Template::file::name and appends results.
+ *
+ * Templates that already contain matrices (ex. enrolled from memory with \ref br_enroll_buffer) are passed through unchanged.
+ * The remaining properties are decoding hints which let the format decode directly to a smaller size or to grayscale.
+ * Reduced size and grayscale decoding are close to, but not bit for bit, a full decode followed by the transforms that reduce the image,
+ * so they are opt-in: set the hints explicitly, or set \c fastDecode to take them from the br::Transform::decodeHints() of the transforms
+ * that follow in a \ref PipeTransform "Pipe", ex. <tt>Open(fastDecode=true)+LimitSize(1024)+Cvt(Gray)</tt>.
  * \author Josh Klontz \cite jklontz
  */
 class OpenTransform : public UntrainableMetaTransform
 {
     Q_OBJECT
+    Q_PROPERTY(int minRows READ get_minRows WRITE set_minRows RESET reset_minRows STORED false)
+    Q_PROPERTY(int minColumns READ get_minColumns WRITE set_minColumns RESET reset_minColumns STORED false)
+    Q_PROPERTY(int minSize READ get_minSize WRITE set_minSize RESET reset_minSize STORED false)
+    Q_PROPERTY(bool gray READ get_gray WRITE set_gray RESET reset_gray STORED false)
+    Q_PROPERTY(bool fastDecode READ get_fastDecode WRITE set_fastDecode RESET reset_fastDecode STORED false)
+    BR_PROPERTY(int, minRows, -1)
+    BR_PROPERTY(int, minColumns, -1)
+    BR_PROPERTY(int, minSize, -1)
+    BR_PROPERTY(bool, gray, false)
+    BR_PROPERTY(bool, fastDecode, false)
+
+    void setDecodeHints(const File &hints)
+    {
+        if (!fastDecode) return;
+        minRows = hints.getInt("minRows", minRows);
+        minColumns = hints.getInt("minColumns", minColumns);
+        minSize = hints.getInt("minSize", minSize);
+        gray = gray || hints.getBool("gray");
+    }
 
     void project(const Template &src, Template &dst) const
     {
+        if (!src.isEmpty()) {
+            dst = src;
+            return;
+        }
+
         if (Globals->verbose) qDebug("Opening %s", qPrintable(src.file.flat()));
         bool fto = false;
-        foreach (const File &file, src.file.split()) {
+        foreach (File file, src.file.split()) {
+            if (minRows > 0) file.insert("minRows", minRows);
+            if (minColumns > 0) file.insert("minColumns", minColumns);
+            if (minSize > 0) file.insert("minSize", minSize);
+            if (gray) file.setBool("gray");
             QScopedPointer<Format> format(Factory<Format>::make(file));
             QList<Mat> mats = format->read();
             if (mats.isEmpty()) {
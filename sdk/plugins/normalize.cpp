@@ -15,11 +15,18 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include <QtConcurrentRun>
+#include <algorithm>
+#include <limits>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif // __SSE__
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <openbr_plugin.h>
 
-#include "core/common.h"
 #include "core/opencvutils.h"
 
 using namespace cv;
@@ -73,6 +80,10 @@ BR_REGISTER(Transform, Normalize)
 /*!
  * \ingroup transforms
  * \brief Normalize each dimension based on training data.
+ *
+ * \c Mean and \c Range accumulate their statistics for every dimension in a single pass over the templates,
+ * either in parallel chunks from train() or block by block from trainBlock().
+ * \c Median needs every value and buffers the blocks.
  * \author Josh Klontz \cite jklontz
  */
 class Center : public Transform
@@ -91,92 +102,318 @@ private:
     BR_PROPERTY(Method, method, Mean)
 
     Mat a, b; // dst = (src - b) / a
+    Mat scale, offset; // dst = src * scale + offset, CV_32F, derived from a and b
 
-    static void _train(Method method, const cv::Mat &m, Mat *ca, Mat *cb, int i)
+    // Per dimension statistics of the flattened templates, sums are taken relative to the first template to limit rounding error
+    struct Statistics
     {
-        double A = 1, B = 0;
-        if      (method == Mean)   mean(m.col(i), &A, &B);
-        else if (method == Median) median(m.col(i), &A, &B);
-        else if (method == Range)  range(m.col(i), &A, &B);
-        else                       qFatal("Center::train invalid method");
-        ca->at<double>(0, i) = A;
-        cb->at<double>(0, i) = B;
+        int count;
+        QVector<double> sum, sumSquares, minimum, maximum;
+
+        Statistics() : count(0) {}
+        Statistics(int dims)
+            : count(0), sum(dims, 0), sumSquares(dims, 0),
+              minimum(dims, std::numeric_limits<double>::max()), maximum(dims, -std::numeric_limits<double>::max()) {}
+
+        void add(const Statistics &other)
+        {
+            for (int i=0; i<sum.size(); i++) {
+                sum[i] += other.sum[i];
+                sumSquares[i] += other.sumSquares[i];
+                minimum[i] = std::min(minimum[i], other.minimum[i]);
+                maximum[i] = std::max(maximum[i], other.maximum[i]);
+            }
+            count += other.count;
+        }
+    };
+
+    // Accumulated by trainBlock()
+    int rows, channels, type;
+    Mat shift;
+    Statistics statistics;
+
+    static void accumulate(Method method, const double *x, const double *shift, Statistics *s)
+    {
+        const int dims = s->sum.size();
+        int i = 0;
+        if (method == Mean) {
+            double *sum = s->sum.data(), *sumSquares = s->sumSquares.data();
+#ifdef __SSE2__
+            for (; i+2<=dims; i+=2) {
+                const __m128d d = _mm_sub_pd(_mm_loadu_pd(x+i), _mm_loadu_pd(shift+i));
+                _mm_storeu_pd(sum+i, _mm_add_pd(_mm_loadu_pd(sum+i), d));
+                _mm_storeu_pd(sumSquares+i, _mm_add_pd(_mm_loadu_pd(sumSquares+i), _mm_mul_pd(d, d)));
+            }
+#endif // __SSE2__
+            for (; i<dims; i++) {
+                const double d = x[i] - shift[i];
+                sum[i] += d;
+                sumSquares[i] += d * d;
+            }
+        } else {
+            double *minimum = s->minimum.data(), *maximum = s->maximum.data();
+#ifdef __SSE2__
+            for (; i+2<=dims; i+=2) {
+                const __m128d v = _mm_loadu_pd(x+i);
+                _mm_storeu_pd(minimum+i, _mm_min_pd(_mm_loadu_pd(minimum+i), v));
+                _mm_storeu_pd(maximum+i, _mm_max_pd(_mm_loadu_pd(maximum+i), v));
+            }
+#endif // __SSE2__
+            for (; i<dims; i++) {
+                minimum[i] = std::min(minimum[i], x[i]);
+                maximum[i] = std::max(maximum[i], x[i]);
+            }
+        }
+        s->count++;
+    }
+
+    void accumulateBlock(const TemplateList *data, int begin, int end, Statistics *s) const
+    {
+        Mat row;
+        for (int i=begin; i<end; i++) {
+            const Mat &m = data->at(i).m();
+            if ((int(m.total()) * m.channels() != shift.cols) || !m.isContinuous())
+                qFatal("Center::train inconsistent template size.");
+            m.reshape(1, 1).convertTo(row, CV_64F);
+            accumulate(method, row.ptr<double>(), shift.ptr<double>(), s);
+        }
+    }
+
+    static void _median(Mat *columns, int begin, int end, Mat *ca, Mat *cb)
+    {
+        const int n = columns->cols;
+        for (int i=begin; i<end; i++) {
+            // Same quantiles as Common::Median without sorting
+            double *vals = columns->ptr<double>(i);
+            std::nth_element(vals, vals+n/2, vals+n);
+            const double median = vals[n/2];
+            std::nth_element(vals, vals+n/4, vals+n/2);
+            const double q1 = vals[n/4];
+            if (3*n/4 > n/2) std::nth_element(vals+n/2+1, vals+3*n/4, vals+n);
+            const double q3 = vals[3*n/4];
+            ca->at<double>(0, i) = q3 - q1;
+            cb->at<double>(0, i) = median;
+        }
+    }
+
+    void projectBlock(const TemplateList *src, int begin, int end, const TemplateList *dst) const
+    {
+        for (int i=begin; i<end; i++) {
+            Mat m = dst->at(i).m();
+            apply(src->at(i).m().ptr<float>(), scale.ptr<float>(), offset.ptr<float>(), m.ptr<float>(), scale.cols);
+        }
+    }
+
+    static void apply(const float *src, const float *scale, const float *offset, float *dst, int size)
+    {
+        int i = 0;
+#ifdef __SSE__
+        for (; i+4<=size; i+=4)
+            _mm_storeu_ps(dst+i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src+i), _mm_loadu_ps(scale+i)), _mm_loadu_ps(offset+i)));
+#endif // __SSE__
+        for (; i<size; i++)
+            dst[i] = src[i] * scale[i] + offset[i];
+    }
+
+    int chunks(int size) const
+    {
+        return ((size > 1000) && Globals->parallelism) ? std::min(size, std::max(1, Globals->parallelism)) : 1;
     }
 
     void train(const TemplateList &data)
     {
-        Mat m;
-        OpenCVUtils::toMat(data.data()).convertTo(m, CV_64F);
-        const int dims = m.cols;
+        if (data.isEmpty()) qFatal("Center::train no training data.");
+        const Mat &first = data.first().m();
+        rows = first.rows;
+        channels = first.channels();
+        type = first.type();
+
+        if (method == Median) {
+            Mat m, columns;
+            OpenCVUtils::toMat(data.data()).reshape(1, data.size()).convertTo(m, CV_64F);
+            transpose(m, columns); // One dimension per row
+            m.release();
+
+            Mat ca(1, columns.rows, CV_64FC1), cb(1, columns.rows, CV_64FC1);
+            const int n = chunks(columns.rows);
+            QList< QFuture<void> > futures;
+            for (int i=0; i<n; i++) {
+                const int begin = i * columns.rows / n, end = (i+1) * columns.rows / n;
+                if (n > 1) futures.append(QtConcurrent::run(_median, &columns, begin, end, &ca, &cb));
+                else                                        _median (&columns, begin, end, &ca, &cb);
+            }
+            if (n > 1) Globals->trackFutures(futures);
+            setCenter(ca, cb);
+            return;
+        }
+
+        first.reshape(1, 1).convertTo(shift, CV_64F);
+        const int n = chunks(data.size());
+        QVector<Statistics> partial(n, Statistics(shift.cols));
+        QList< QFuture<void> > futures;
+        for (int i=0; i<n; i++) {
+            const int begin = i * data.size() / n, end = (i+1) * data.size() / n;
+            if (n > 1) futures.append(QtConcurrent::run(this, &Center::accumulateBlock, &data, begin, end, &partial[i]));
+            else                                                      accumulateBlock (&data, begin, end, &partial[i]);
+        }
+        if (n > 1) Globals->trackFutures(futures);
+
+        statistics = partial[0];
+        for (int i=1; i<n; i++)
+            statistics.add(partial[i]);
+        finishStatistics();
+    }
+
+    void beginTrain()
+    {
+        if (method == Median) {
+            Transform::beginTrain();
+            return;
+        }
+        statistics = Statistics();
+    }
 
-        vector<Mat> mv, av, bv;
-        split(m, mv);
-        for (size_t c = 0; c < mv.size(); c++) {
-            av.push_back(Mat(1, dims, CV_64FC1));
-            bv.push_back(Mat(1, dims, CV_64FC1));
+    void trainBlock(const TemplateList &data)
+    {
+        if (method == Median) {
+            Transform::trainBlock(data);
+            return;
         }
+        if (data.isEmpty()) return;
 
-        QList< QFuture<void> > futures; futures.reserve(dims);
-        const bool parallel = (data.size() > 1000) && Globals->parallelism;
+        if (statistics.count == 0) {
+            const Mat &first = data.first().m();
+            rows = first.rows;
+            channels = first.channels();
+            type = first.type();
+            first.reshape(1, 1).convertTo(shift, CV_64F);
+            statistics = Statistics(shift.cols);
+        }
+        accumulateBlock(&data, 0, data.size(), &statistics);
+    }
 
-        for (size_t c = 0; c < mv.size(); c++) {
-            for (int i=0; i<dims; i++)
-                if (parallel) futures.append(QtConcurrent::run(_train, method, mv[c], &av[c], &bv[c], i));
-                else                                           _train (method, mv[c], &av[c], &bv[c], i);
-            av[c] = av[c].reshape(1, data.first().m().rows);
-            bv[c] = bv[c].reshape(1, data.first().m().rows);
+    void finishTrain()
+    {
+        if (method == Median) {
+            Transform::finishTrain();
+            return;
         }
+        if (statistics.count == 0) qFatal("Center::finishTrain no training data.");
+        finishStatistics();
+    }
 
-        if (parallel) Globals->trackFutures(futures);
+    void finishStatistics()
+    {
+        const int dims = statistics.sum.size();
+        Mat ca(1, dims, CV_64FC1), cb(1, dims, CV_64FC1);
+        for (int i=0; i<dims; i++) {
+            if (method == Mean) {
+                const double mean = statistics.sum[i] / statistics.count;
+                const double variance = statistics.sumSquares[i] / statistics.count - mean * mean;
+                ca.at<double>(0, i) = std::sqrt(std::max(variance, 0.0)); // Rounding error
+                cb.at<double>(0, i) = shift.at<double>(0, i) + mean;
+            } else {
+                ca.at<double>(0, i) = statistics.maximum[i] - statistics.minimum[i];
+                cb.at<double>(0, i) = statistics.minimum[i];
+            }
+        }
+        statistics = Statistics();
+        shift.release();
+        setCenter(ca, cb);
+    }
 
-        merge(av, a);
-        merge(bv, b);
-        a.convertTo(a, data.first().m().type());
-        b.convertTo(b, data.first().m().type());
+    void setCenter(const Mat &ca, const Mat &cb)
+    {
+        ca.reshape(channels, rows).convertTo(a, type);
+        cb.reshape(channels, rows).convertTo(b, type);
         OpenCVUtils::saveImage(a, Globals->property("CENTER_TRAIN_A").toString());
         OpenCVUtils::saveImage(b, Globals->property("CENTER_TRAIN_B").toString());
+        initScale();
     }
 
-    void project(const Template &src, Template &dst) const
+    void initScale()
     {
-        subtract(src, b, dst);
-        divide(dst, a, dst);
+        scale.release();
+        offset.release();
+        if ((a.type() != CV_32FC(a.channels())) || !a.isContinuous() || !b.isContinuous()) return;
+
+        // Zero where a is zero, like divide()
+        Mat ca, cb;
+        a.reshape(1, 1).convertTo(ca, CV_64F);
+        b.reshape(1, 1).convertTo(cb, CV_64F);
+        scale.create(1, ca.cols, CV_32FC1);
+        offset.create(1, ca.cols, CV_32FC1);
+        for (int i=0; i<ca.cols; i++) {
+            const double s = ca.at<double>(0, i) == 0 ? 0 : 1 / ca.at<double>(0, i);
+            scale.at<float>(0, i) = s;
+            offset.at<float>(0, i) = -cb.at<double>(0, i) * s;
+        }
     }
 
-    void store(QDataStream &stream) const
+    bool fused(const Mat &m) const
     {
-        stream << a << b;
+        return !scale.empty() && (m.type() == a.type()) && (m.size() == a.size()) && m.isContinuous();
     }
 
-    void load(QDataStream &stream)
+    void project(const Template &src, Template &dst) const
     {
-        stream >> a >> b;
+        const Mat &m = src;
+        if (!fused(m)) {
+            subtract(src, b, dst);
+            divide(dst, a, dst);
+            return;
+        }
+        Mat result;
+        result.allocator = matrixAllocator();
+        result.create(m.size(), m.type());
+        apply(m.ptr<float>(), scale.ptr<float>(), offset.ptr<float>(), result.ptr<float>(), scale.cols);
+        dst = result;
     }
 
-    static void mean(const Mat &src, double *a, double *b)
+    bool batched() const
     {
-        Scalar mean, stddev;
-        meanStdDev(src, mean, stddev);
-        *a = stddev[0];
-        *b = mean[0];
+        return true;
+    }
+
+    void project(const TemplateList &src, TemplateList &dst) const
+    {
+        foreach (const Template &t, src)
+            if ((t.size() != 1) || !fused(t)) {
+                Transform::project(src, dst);
+                return;
+            }
+
+        // Each output gets its own matrix, filled in parallel chunks
+        TemplateList results;
+        results.reserve(src.size());
+        foreach (const Template &t, src) {
+            Mat result;
+            result.allocator = matrixAllocator();
+            result.create(t.m().size(), t.m().type());
+            results.append(Template(t.file, result));
+        }
+
+        const int n = chunks(src.size());
+        QList< QFuture<void> > futures;
+        for (int i=0; i<n; i++) {
+            const int begin = i * src.size() / n, end = (i+1) * src.size() / n;
+            if (n > 1) futures.append(QtConcurrent::run(this, &Center::projectBlock, &src, begin, end, &results));
+            else                                                      projectBlock (&src, begin, end, &results);
+        }
+        if (n > 1) Globals->trackFutures(futures);
+
+        dst.append(results);
     }
 
-    static void median(const Mat &src, double *a, double *b)
+    void store(QDataStream &stream) const
     {
-        QVector<double> vals; vals.reserve(src.rows);
-        for (int i=0; i<src.rows; i++)
-            vals.append(src.at<double>(i, 0));
-        double q1, q3;
-        *b = Common::Median(vals, &q1, &q3);
-        *a = q3 - q1;
+        stream << a << b;
     }
 
-    static void range(const Mat &src, double *a, double *b)
+    void load(QDataStream &stream)
     {
-        double min, max;
-        minMaxLoc(src, &min, &max);
-        *a = max - min;
-        *b = min;
+        stream >> a >> b;
+        initScale();
     }
 };
 
@@ -14,6 +14,8 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
 #include <QByteArray>
 #include <QCoreApplication>
 #include <QDebug>
@@ -22,6 +24,7 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QList>
+#include <QMap>
 #ifndef BR_EMBEDDED
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
@@ -29,9 +32,12 @@
 #endif // BR_EMBEDDED
 #include <QMutex>
 #include <QPair>
+#include <QTime>
 #include <QVector>
 #include <QtGlobal>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <assert.h>
@@ -44,33 +50,242 @@
 
 using namespace br;
 
+/*!
+ * \ingroup outputs
+ * \brief Base class for text outputs written one block of query rows at a time.
+ *
+ * A block is formatted by the thread that sets its last score,
+ * then written in query order through a small reorder buffer,
+ * so only the blocks still being compared are held in memory.
+ * Derived classes must call finish() in their destructor.
+ */
+class StreamingOutput : public Output
+{
+    Q_OBJECT
+
+    struct Block
+    {
+        cv::Mat scores;
+        QAtomicInt remaining;
+    };
+
+    bool active;
+    int rowsPerBlock, blockCount, nextBlock;
+    QAtomicPointer<Block> *blocks;
+    QMap<int,QByteArray> pending; // Formatted blocks waiting on earlier ones
+    QMutex writeLock;
+    QFile out;
+    QVector<bool> labelColumns;
+
+protected:
+    StreamingOutput() : active(false), blocks(NULL) {}
+
+    ~StreamingOutput()
+    {
+        delete[] blocks;
+    }
+
+    virtual bool terminal() const { return file.baseName() == "terminal"; } /*!< \brief Write to \c stdout instead of #file. */
+    virtual QByteArray header() const { return QByteArray(); } /*!< \brief Written before the first block. */
+    virtual QByteArray footer() const { return QByteArray(); } /*!< \brief Written after the last block. */
+    virtual void format(const cv::Mat &scores, int rowOffset, QByteArray &text) const = 0; /*!< \brief Appends the rows of a completed block. */
+
+    void initialize(const FileList &targetFiles, const FileList &queryFiles)
+    {
+        Output::initialize(targetFiles, queryFiles);
+        active = !targetFiles.isEmpty() && !queryFiles.isEmpty() && (terminal() || !file.isNull());
+        if (!active) return;
+
+        labelColumns = QVector<bool>(targetFiles.size());
+        for (int j=0; j<targetFiles.size(); j++)
+            labelColumns[j] = (targetFiles[j] == "Label");
+
+        rowsPerBlock = std::max(1, Globals->blockSize);
+        blockCount = (queryFiles.size() + rowsPerBlock - 1) / rowsPerBlock;
+        nextBlock = 0;
+        blocks = new QAtomicPointer<Block>[blockCount];
+
+        if (terminal()) {
+            out.open(stdout, QFile::WriteOnly);
+        } else {
+            out.setFileName(file);
+            QtUtils::touchDir(out);
+            if (!out.open(QFile::WriteOnly)) qFatal("StreamingOutput::initialize failed to open %s for writing.", qPrintable((QString)file));
+        }
+        out.write(header());
+    }
+
+    // Writes whatever has not been written yet, including blocks with unset scores
+    void finish()
+    {
+        if (!active) return;
+        active = false;
+
+        for (int b=nextBlock; b<blockCount; b++) {
+            if (!pending.contains(b)) {
+                Block *block = blocks[b];
+                const cv::Mat scores = block ? block->scores : cv::Mat::zeros(rows(b), targetFiles.size(), CV_32FC1);
+                QByteArray text;
+                format(scores, b*rowsPerBlock, text);
+                pending.insert(b, text);
+                delete block;
+            }
+            out.write(pending.take(b));
+        }
+        out.write(footer());
+        out.close();
+    }
+
+    void appendScore(QByteArray &text, float value, int column) const
+    {
+        if (labelColumns[column]) text.append(File::subject(value).toLocal8Bit());
+        else                      appendFloat(text, value);
+    }
+
+    // Appends the value as QString::number() would, "%g" with six significant digits
+    static void appendFloat(QByteArray &text, float value)
+    {
+        if (appendSignificant(text, value)) return;
+
+        char buffer[32];
+        const int length = snprintf(buffer, sizeof(buffer), "%g", double(value));
+        text.append(buffer, length);
+    }
+
+private:
+    // Rounds to the nearest integer, returning false when too close to a tie to decide without exact arithmetic
+    static inline bool roundDigits(double scaled, qint64 *digits)
+    {
+        const double whole = floor(scaled);
+        if (fabs(scaled - whole - 0.5) < 1e-6) return false;
+        *digits = qint64(whole) + (scaled - whole > 0.5 ? 1 : 0);
+        return true;
+    }
+
+    // Fast path of appendFloat() for fixed notation, returns false if snprintf() is needed
+    static bool appendSignificant(QByteArray &text, float value)
+    {
+        static const double Scales[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+        static const qint64 Powers[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+        const double magnitude = fabs(value);
+        if ((magnitude < 1e-4) || (magnitude >= 999999.5)) return false;
+
+        // Six significant digits as an integer
+        int exponent = int(floor(log10(magnitude)));
+        exponent = std::max(-4, std::min(5, exponent));
+        qint64 digits;
+        if (!roundDigits(magnitude * Scales[5-exponent], &digits)) return false;
+        if ((digits >= 1000000) && (exponent < 5)) {
+            if (!roundDigits(magnitude * Scales[5 - ++exponent], &digits)) return false;
+        } else if ((digits < 100000) && (exponent > -4)) {
+            if (!roundDigits(magnitude * Scales[5 - --exponent], &digits)) return false;
+        }
+        if (digits >= 1000000) return false;
+
+        char buffer[32];
+        int decimals = 5 - exponent;
+        const qint64 integer = digits / Powers[decimals];
+        qint64 fraction = digits % Powers[decimals];
+
+        char *p = buffer;
+        if (value < 0) *p++ = '-';
+        p = appendInteger(p, integer);
+        if (fraction != 0) {
+            while (fraction % 10 == 0) { fraction /= 10; decimals--; }
+            *p++ = '.';
+            for (int i=decimals-1; i>=0; i--)
+                *p++ = '0' + (fraction / Powers[i]) % 10;
+        }
+        text.append(buffer, p - buffer);
+        return true;
+    }
+
+    static char *appendInteger(char *p, qint64 value)
+    {
+        char digits[20];
+        int n = 0;
+        do { digits[n++] = '0' + value % 10; value /= 10; } while (value > 0);
+        while (n > 0) *p++ = digits[--n];
+        return p;
+    }
+
+    int rows(int block) const
+    {
+        return std::min(rowsPerBlock, queryFiles.size() - block*rowsPerBlock);
+    }
+
+    void set(float value, int i, int j)
+    {
+        if (!active) return;
+        const int b = i / rowsPerBlock;
+
+        Block *block = blocks[b];
+        if (!block) {
+            Block *newBlock = new Block();
+            newBlock->scores = cv::Mat::zeros(rows(b), targetFiles.size(), CV_32FC1);
+            newBlock->remaining = newBlock->scores.rows * newBlock->scores.cols;
+            if (blocks[b].testAndSetOrdered(NULL, newBlock)) {
+                block = newBlock;
+            } else {
+                delete newBlock;
+                block = blocks[b];
+            }
+        }
+
+        block->scores.at<float>(i - b*rowsPerBlock, j) = value;
+        if (!block->remaining.deref()) complete(b, block);
+    }
+
+    void complete(int b, Block *block)
+    {
+        QByteArray text;
+        format(block->scores, b*rowsPerBlock, text);
+
+        QMutexLocker locker(&writeLock);
+        blocks[b] = NULL;
+        delete block;
+        pending.insert(b, text);
+        while (pending.contains(nextBlock) && (nextBlock < blockCount))
+            out.write(pending.take(nextBlock++));
+    }
+};
+
 /*!
  * \ingroup outputs
  * \brief Comma separated values output.
  * \author Josh Klontz \cite jklontz
  */
-class csvOutput : public MatrixOutput
+class csvOutput : public StreamingOutput
 {
     Q_OBJECT
 
     ~csvOutput()
     {
-        if (file.isNull() || targetFiles.isEmpty() || queryFiles.isEmpty()) return;
-        QFile out(file);
-        bool success = out.open(QFile::WriteOnly);
-        if (!success) qFatal("Output::saveCSV failed to open %s for writing.", qPrintable((QString)file));
-        out.write("File,");
-        out.write(qPrintable(targetFiles.names().join(",")));
-        out.write("\n");
-        for (int i=0; i<queryFiles.size(); i++) {
-            out.write(qPrintable(queryFiles[i].name));
-            for (int j=0; j<targetFiles.size(); j++) {
-                out.write(",");
-                out.write(qPrintable(toString(i,j)));
+        finish();
+    }
+
+    bool terminal() const
+    {
+        return false;
+    }
+
+    QByteArray header() const
+    {
+        return "File," + targetFiles.names().join(",").toLocal8Bit() + "\n";
+    }
+
+    void format(const cv::Mat &scores, int rowOffset, QByteArray &text) const
+    {
+        for (int i=0; i<scores.rows; i++) {
+            text.append(queryFiles[rowOffset+i].name.toLocal8Bit());
+            const float *row = scores.ptr<float>(i);
+            for (int j=0; j<scores.cols; j++) {
+                text.append(',');
+                appendScore(text, row[j], j);
             }
-            out.write("\n");
+            text.append('\n');
         }
-        out.close();
     }
 };
 
@@ -81,40 +296,62 @@ BR_REGISTER(Output, csvOutput)
  * \brief One score per row.
  * \author Josh Klontz \cite jklontz
  */
-class meltOutput : public MatrixOutput
+class meltOutput : public StreamingOutput
 {
     Q_OBJECT
 
+    bool genuineOnly, impostorOnly;
+    QByteArray keys, values;
+    QList<float> queryLabels, targetLabels;
+    QList<QByteArray> queryNames, targetNames;
+
     ~meltOutput()
     {
-        if (file.isNull() || targetFiles.isEmpty() || queryFiles.isEmpty()) return;
-        const bool genuineOnly = file.contains("Genuine") && !file.contains("Impostor");
-        const bool impostorOnly = file.contains("Impostor") && !file.contains("Genuine");
+        finish();
+    }
+
+    void initialize(const FileList &targetFiles, const FileList &queryFiles)
+    {
+        genuineOnly = file.contains("Genuine") && !file.contains("Impostor");
+        impostorOnly = file.contains("Impostor") && !file.contains("Genuine");
 
         QHash<QString,QVariant> args = file.localMetadata();
         args.remove("Genuine");
         args.remove("Impostor");
+        foreach (const QString &key, args.keys()) keys += "," + key.toLocal8Bit();
+        foreach (const QVariant &value, args.values()) values += "," + value.toString().toLocal8Bit();
 
-        QString keys; foreach (const QString &key, args.keys()) keys += "," + key;
-        QString values; foreach (const QVariant &value, args.values()) values += "," + value.toString();
+        queryLabels = queryFiles.labels();
+        targetLabels = targetFiles.labels();
+        foreach (const File &query, queryFiles) queryNames.append(query.name.toLocal8Bit());
+        foreach (const File &target, targetFiles) targetNames.append(target.name.toLocal8Bit());
 
-        QStringList lines;
-        if (file.baseName() != "terminal") lines.append(QString("Query,Target,Mask,Similarity%1").arg(keys));
-        QList<float> queryLabels = queryFiles.labels();
-        QList<float> targetLabels = targetFiles.labels();
-        for (int i=0; i<queryFiles.size(); i++) {
-            for (int j=(selfSimilar ? i+1 : 0); j<targetFiles.size(); j++) {
+        StreamingOutput::initialize(targetFiles, queryFiles);
+    }
+
+    QByteArray header() const
+    {
+        if (file.baseName() == "terminal") return QByteArray();
+        return "Query,Target,Mask,Similarity" + keys + "\n";
+    }
+
+    void format(const cv::Mat &scores, int rowOffset, QByteArray &text) const
+    {
+        for (int r=0; r<scores.rows; r++) {
+            const int i = rowOffset + r;
+            const float *row = scores.ptr<float>(r);
+            for (int j=(selfSimilar ? i+1 : 0); j<scores.cols; j++) {
                 const bool genuine = queryLabels[i] == targetLabels[j];
                 if ((genuineOnly && !genuine) || (impostorOnly && genuine)) continue;
-                lines.append(QString("%1,%2,%3,%4%5").arg(queryFiles[i],
-                                                          targetFiles[j],
-                                                          QString::number(genuine),
-                                                          QString::number(data.at<float>(i,j)),
-                                                          values));
+                text.append(queryNames[i]);
+                text.append(',');
+                text.append(targetNames[j]);
+                text.append(genuine ? ",1," : ",0,");
+                appendFloat(text, row[j]);
+                text.append(values);
+                text.append('\n');
             }
         }
-
-        QtUtils::writeFile(file, lines);
     }
 };
 
@@ -143,32 +380,60 @@ BR_REGISTER(Output, mtxOutput)
  * \brief Rank retrieval output.
  * \author Josh Klontz \cite jklontz
  */
-class rrOutput : public MatrixOutput
+class rrOutput : public StreamingOutput
 {
     Q_OBJECT
 
+    int limit;
+    bool flat, index, score, invert;
+
     ~rrOutput()
     {
-        if (file.isNull() || targetFiles.isEmpty() || queryFiles.isEmpty()) return;
-        const int limit = file.getInt("limit", 20);
-        const bool flat = file.getBool("flat");
-        const bool index = file.getBool("index");
-        const bool score = file.getBool("score");
-        const bool invert = file.getBool("invert");
+        finish();
+    }
 
-        QStringList lines;
-        for (int i=0; i<queryFiles.size(); i++) {
-            QStringList files;
-            if (!flat) files.append(queryFiles[i]);
-
-            typedef QPair<float,int> Pair;
-            foreach (const Pair &pair, Common::Sort(OpenCVUtils::matrixToVector(data.row(i)), !invert).mid(0, limit))
-                files.append((index ? QString::number(pair.second) : targetFiles[pair.second].name) +
-                             (score ? "=" + QString::number(pair.first) : ""));
-            lines.append(files.join(flat ? "\n" : ","));
-        }
+    void initialize(const FileList &targetFiles, const FileList &queryFiles)
+    {
+        limit = file.getInt("limit", 20);
+        flat = file.getBool("flat");
+        index = file.getBool("index");
+        score = file.getBool("score");
+        invert = file.getBool("invert");
+        StreamingOutput::initialize(targetFiles, queryFiles);
+    }
 
-        QtUtils::writeFile(file, lines);
+    void format(const cv::Mat &scores, int rowOffset, QByteArray &text) const
+    {
+        typedef QPair<float,int> Pair;
+        const int shortlist = ((limit < 0) || (limit > scores.cols)) ? scores.cols : limit;
+        QVector<Pair> pairs(scores.cols);
+        for (int r=0; r<scores.rows; r++) {
+            const float *row = scores.ptr<float>(r);
+            for (int j=0; j<scores.cols; j++)
+                pairs[j] = Pair(row[j], j);
+
+            // Same order as Common::Sort, ties broken by index
+            if (invert) std::partial_sort(pairs.begin(), pairs.begin()+shortlist, pairs.end());
+            else        std::partial_sort(pairs.begin(), pairs.begin()+shortlist, pairs.end(), std::greater<Pair>());
+
+            const char separator = flat ? '\n' : ',';
+            bool first = true;
+            if (!flat) {
+                text.append(queryFiles[rowOffset+r].name.toLocal8Bit());
+                first = false;
+            }
+            for (int k=0; k<shortlist; k++) {
+                if (!first) text.append(separator);
+                first = false;
+                if (index) text.append(QByteArray::number(pairs[k].second));
+                else       text.append(targetFiles[pairs[k].second].name.toLocal8Bit());
+                if (score) {
+                    text.append('=');
+                    appendFloat(text, pairs[k].first);
+                }
+            }
+            text.append('\n');
+        }
     }
 };
 
@@ -200,41 +465,60 @@ BR_REGISTER(Output, txtOutput)
  * \brief Output to the terminal.
  * \author Josh Klontz \cite jklontz
  */
-class EmptyOutput : public MatrixOutput
+class EmptyOutput : public StreamingOutput
 {
     Q_OBJECT
 
-    static QString bufferString(const QString &string, int length)
+    static const int CELL_SIZE = 12;
+
+    static QByteArray bufferString(const QByteArray &string, int length)
     {
         if (string.size() >= length)
             return string.left(length);
-        QString buffer; buffer.fill(' ', length-string.size());
-        return string+buffer;
+        return string + QByteArray(length-string.size(), ' ');
     }
 
     ~EmptyOutput()
     {
-        if (targetFiles.isEmpty() || queryFiles.isEmpty()) return;
-        QString result;
-        if ((queryFiles.size() == 1) && (targetFiles.size() == 1)) {
-            result = toString(0,0) + "\n";
-        } else {
-            const int CELL_SIZE = 12;
-
-            result = bufferString(" ", CELL_SIZE) + " ";
-            foreach (const QString &targetName, targetFiles.names())
-                result += bufferString(targetName, CELL_SIZE) + " ";
-            result += "\n";
-
-            for (int i=0; i<queryFiles.size(); i++) {
-                result += bufferString(queryFiles[i].name, CELL_SIZE) + " ";
-                for (int j=0; j<targetFiles.size(); j++)
-                    result += bufferString(toString(i,j), CELL_SIZE) + " ";
-                result += "\n";
+        finish();
+    }
+
+    bool terminal() const
+    {
+        return true;
+    }
+
+    bool single() const
+    {
+        return (queryFiles.size() == 1) && (targetFiles.size() == 1);
+    }
+
+    QByteArray header() const
+    {
+        if (single()) return QByteArray();
+        QByteArray result = bufferString(" ", CELL_SIZE) + " ";
+        foreach (const QString &targetName, targetFiles.names())
+            result += bufferString(targetName.toLocal8Bit(), CELL_SIZE) + " ";
+        return result + "\n";
+    }
+
+    QByteArray footer() const
+    {
+        return "\n";
+    }
+
+    void format(const cv::Mat &scores, int rowOffset, QByteArray &text) const
+    {
+        for (int i=0; i<scores.rows; i++) {
+            if (!single()) text.append(bufferString(queryFiles[rowOffset+i].name.toLocal8Bit(), CELL_SIZE) + " ");
+            for (int j=0; j<scores.cols; j++) {
+                QByteArray cell;
+                appendScore(cell, scores.at<float>(i, j), j);
+                if (single()) text.append(cell);
+                else          text.append(bufferString(cell, CELL_SIZE) + " ");
             }
+            text.append('\n');
         }
-
-        printf("%s\n", qPrintable(result));
     }
 };
 
@@ -244,6 +528,8 @@ BR_REGISTER(Output, EmptyOutput)
  * \ingroup outputs
  * \brief The highest scoring matches.
  * \author Josh Klontz \cite jklontz
+ *
+ * Given an \c interval in milliseconds, the matches so far are published to Output observers at most that often while comparing.
  */
 class tailOutput : public Output
 {
@@ -274,9 +560,12 @@ class tailOutput : public Output
     float lastValue;
     QList<Comparison> comparisons;
     QMutex comparisonsLock;
+    int interval; // Milliseconds between snapshots, negative to publish only the final result
+    QTime lastSnapshot;
 
     ~tailOutput()
     {
+        snapshot();
         if (file.isNull() || comparisons.isEmpty()) return;
         QStringList lines; lines.reserve(comparisons.size()+1);
         lines.append("Value,Target,Query");
@@ -292,7 +581,27 @@ class tailOutput : public Output
         atLeast = file.getInt("atLeast", 1);
         atMost = file.getInt("atMost", std::numeric_limits<int>::max());
         args = file.getBool("args");
+        interval = file.getInt("interval", -1);
         lastValue = -std::numeric_limits<float>::max();
+        lastSnapshot.start();
+    }
+
+    // Call with comparisonsLock held
+    void snapshot(QList<float> &scores, FileList &targets, FileList &queries) const
+    {
+        foreach (const Comparison &comparison, comparisons) {
+            scores.append(comparison.value);
+            targets.append(comparison.target);
+            queries.append(comparison.query);
+        }
+    }
+
+    void snapshot()
+    {
+        QList<float> scores;
+        FileList targets, queries;
+        snapshot(scores, targets, queries);
+        publish(scores, targets, queries);
     }
 
     void set(float value, int i, int j)
@@ -323,7 +632,17 @@ class tailOutput : public Output
         while ((comparisons.size() > atLeast) && (comparisons.last().value < threshold))
             comparisons.removeLast();
         lastValue = comparisons.last().value;
+
+        QList<float> scores;
+        FileList targets, queries;
+        const bool publishing = (interval >= 0) && (lastSnapshot.elapsed() >= interval);
+        if (publishing) {
+            snapshot(scores, targets, queries);
+            lastSnapshot.restart();
+        }
         comparisonsLock.unlock();
+
+        if (publishing) publish(scores, targets, queries);
     }
 };
 
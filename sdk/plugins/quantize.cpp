@@ -14,6 +14,11 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <QHash>
+#include <limits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif // __AVX2__
 #include <openbr_plugin.h>
 
 #include "core/opencvutils.h"
@@ -34,6 +39,8 @@ class Quantize : public Transform
     BR_PROPERTY(float, a, 1)
     BR_PROPERTY(float, b, 0)
 
+    double trainMin, trainMax; // Accumulated by trainBlock()
+
     void train(const TemplateList &data)
     {
         double minVal, maxVal;
@@ -42,6 +49,28 @@ class Quantize : public Transform
         b = -a*minVal;
     }
 
+    void beginTrain()
+    {
+        trainMin = std::numeric_limits<double>::max();
+        trainMax = -std::numeric_limits<double>::max();
+    }
+
+    void trainBlock(const TemplateList &data)
+    {
+        foreach (const Template &t, data) {
+            double minVal, maxVal;
+            minMaxLoc(t, &minVal, &maxVal);
+            trainMin = std::min(trainMin, minVal);
+            trainMax = std::max(trainMax, maxVal);
+        }
+    }
+
+    void finishTrain()
+    {
+        a = 255.0/(trainMax-trainMin);
+        b = -a*trainMin;
+    }
+
     void project(const Template &src, Template &dst) const
     {
         src.m().convertTo(dst, CV_8U, a, b);
@@ -106,4 +135,182 @@ class Pack : public UntrainableTransform
 
 BR_REGISTER(Transform, Pack)
 
+/*!
+ * \ingroup transforms
+ * \brief Product quantization \cite jegou11
+ *
+ * The feature vector is split into \em m subvectors, each replaced by the index of the nearest of 256 centroids learned with k-means.
+ * The last matrix of the template is a 4 byte model key followed by the \em m bytes of codes.
+ * When \em tables is \c true it is preceded by the template's \em m x 256 table of squared L2 distances from each of its subvectors to each centroid,
+ * which ProductQuantizationDistance needs on the query side only, galleries that are only compared against can leave it out to keep just the codes.
+ */
+class ProductQuantizer : public Transform
+{
+    Q_OBJECT
+    Q_PROPERTY(int m READ get_m WRITE set_m RESET reset_m STORED false)
+    Q_PROPERTY(bool tables READ get_tables WRITE set_tables RESET reset_tables STORED false)
+    BR_PROPERTY(int, m, 16)
+    BR_PROPERTY(bool, tables, true)
+
+    QList<Mat> centers; // One 256 x subvector length matrix per subspace
+    uint key;
+
+    int begin(int subspace, int dims) const { return subspace * dims / m; }
+
+    // Identifies the model, codes and tables from different models can't be compared
+    void initKey()
+    {
+        QByteArray data;
+        foreach (const Mat &subspaceCenters, centers)
+            data.append(QByteArray::fromRawData((const char*)subspaceCenters.data, subspaceCenters.total()*subspaceCenters.elemSize()));
+        key = qHash(data);
+    }
+
+    void train(const TemplateList &data)
+    {
+        Mat features;
+        OpenCVUtils::toMatByRow(data.data()).convertTo(features, CV_32F);
+        if (features.cols < m) qFatal("ProductQuantizer::train feature vector shorter than m.");
+        if (features.rows < 256) qFatal("ProductQuantizer::train requires at least 256 templates.");
+
+        centers.clear();
+        for (int i=0; i<m; i++) {
+            const Mat subvectors = features.colRange(begin(i, features.cols), begin(i+1, features.cols)).clone();
+            Mat labels, subspaceCenters;
+            kmeans(subvectors, 256, labels, TermCriteria(TermCriteria::MAX_ITER, 10, 0), 3, KMEANS_PP_CENTERS, subspaceCenters);
+            centers.append(subspaceCenters);
+        }
+        initKey();
+    }
+
+    void project(const Template &src, Template &dst) const
+    {
+        Mat features;
+        src.m().reshape(1, 1).convertTo(features, CV_32F);
+        int dims = 0;
+        foreach (const Mat &subspaceCenters, centers)
+            dims += subspaceCenters.cols;
+        CV_Assert(features.cols == dims);
+
+        Mat table(m, 256, CV_32FC1);
+        Mat code(1, sizeof(uint) + m, CV_8UC1);
+        *reinterpret_cast<uint*>(code.data) = key;
+        for (int i=0; i<m; i++) {
+            const Mat subvector = features.colRange(begin(i, dims), begin(i+1, dims));
+            float *distances = table.ptr<float>(i);
+            int best = 0;
+            for (int j=0; j<256; j++) {
+                distances[j] = norm(subvector, centers[i].row(j), NORM_L2SQR);
+                if (distances[j] < distances[best]) best = j;
+            }
+            code.data[sizeof(uint) + i] = best;
+        }
+        if (tables) dst += table;
+        dst += code;
+    }
+
+    void store(QDataStream &stream) const
+    {
+        stream << m << centers;
+    }
+
+    void load(QDataStream &stream)
+    {
+        stream >> m >> centers;
+        initKey();
+    }
+};
+
+BR_REGISTER(Transform, ProductQuantizer)
+
+/*!
+ * \ingroup distances
+ * \brief Negative asymmetric squared L2 distance between a ProductQuantizer query and target codes.
+ *
+ * The query is represented by its distance table, computed from its features before quantization,
+ * and each target by its codes, so comparing costs one table lookup and addition per code byte and
+ * only the target is approximated \cite jegou11.
+ * The query must have been projected with ProductQuantizer's \em tables set,
+ * pairs that can't be compared (no table, different models) score \c -FLT_MAX.
+ * Lookups are gathered eight subspaces at a time when built with AVX2.
+ */
+class ProductQuantizationDistance : public Distance
+{
+    Q_OBJECT
+
+    static uint key(const Mat &code)
+    {
+        return *reinterpret_cast<const uint*>(code.data);
+    }
+
+    // The query's table, or NULL if it can't be compared with codes of this model and length
+    static const float *table(const Template &query, const Mat &code)
+    {
+        if ((query.size() < 2) || (query.last().total() != code.total()) || (key(query.last()) != key(code))) return NULL;
+        const Mat &table = query[query.size()-2];
+        if ((table.type() != CV_32FC1) || (table.rows != int(code.total() - sizeof(uint))) || (table.cols != 256) || !table.isContinuous()) return NULL;
+        return table.ptr<float>();
+    }
+
+    static float score(const float *table, const uchar *codes, int m)
+    {
+        int i = 0;
+        float distance = 0;
+#ifdef __AVX2__
+        const __m256i offsets = _mm256_setr_epi32(0, 256, 2*256, 3*256, 4*256, 5*256, 6*256, 7*256);
+        __m256 sum = _mm256_setzero_ps();
+        for (; i+8<=m; i+=8) {
+            const __m256i indices = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(codes+i))), offsets);
+            sum = _mm256_add_ps(sum, _mm256_i32gather_ps(table + i*256, indices, sizeof(float)));
+        }
+        float sums[8];
+        _mm256_storeu_ps(sums, sum);
+        distance = ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+#endif // __AVX2__
+        float distance0 = 0, distance1 = 0, distance2 = 0, distance3 = 0;
+        for (; i+4<=m; i+=4) {
+            distance0 += table[(i+0)*256 + codes[i+0]];
+            distance1 += table[(i+1)*256 + codes[i+1]];
+            distance2 += table[(i+2)*256 + codes[i+2]];
+            distance3 += table[(i+3)*256 + codes[i+3]];
+        }
+        for (; i<m; i++)
+            distance0 += table[i*256 + codes[i]];
+        return -(distance + distance0 + distance1 + distance2 + distance3);
+    }
+
+    void compareBlock(const TemplateList &target, const TemplateList &query, Output *output, int targetOffset, int queryOffset) const
+    {
+        const float scale = property("a").toFloat();
+        const float shift = property("b").toFloat();
+        for (int i=0; i<query.size(); i++) {
+            bool warned = false;
+            for (int j=0; j<target.size(); j++) {
+                const Mat &t = target[j].m();
+                const float *lut = table(query[i], t);
+                if (lut == NULL) {
+                    if (!warned) qWarning("ProductQuantizationDistance can't compare %s, it needs a ProductQuantizer table from the targets' model.", qPrintable(query[i].file.flat()));
+                    warned = true;
+                    output->setRelative(-std::numeric_limits<float>::max(), i+queryOffset, j+targetOffset);
+                    continue;
+                }
+                output->setRelative(scale * (score(lut, t.data + sizeof(uint), t.total() - sizeof(uint)) - shift), i+queryOffset, j+targetOffset);
+            }
+        }
+    }
+
+    // Either side can be the query
+    float _compare(const Template &a, const Template &b) const
+    {
+        const float *lut = table(b, a.m());
+        if (lut != NULL) return score(lut, a.m().data + sizeof(uint), a.m().total() - sizeof(uint));
+        lut = table(a, b.m());
+        if (lut != NULL) return score(lut, b.m().data + sizeof(uint), b.m().total() - sizeof(uint));
+        qWarning("ProductQuantizationDistance can't compare %s and %s, one needs a ProductQuantizer table from the other's model.", qPrintable(a.file.flat()), qPrintable(b.file.flat()));
+        return -std::numeric_limits<float>::max();
+    }
+};
+
+BR_REGISTER(Distance, ProductQuantizationDistance)
+
 #include "quantize.moc"
@@ -65,15 +65,12 @@ class Affine : public UntrainableTransform
         else           dstPoints[2] = Point2f(x3*width, y3*height);
 
         Point2f srcPoints[3];
-        if (src.file.contains("Affine_0_X") &&
-            src.file.contains("Affine_0_Y") &&
-            src.file.contains("Affine_1_X") &&
-            src.file.contains("Affine_1_Y") &&
-            (src.file.contains("Affine_2_X") || twoPoints) &&
-            (src.file.contains("Affine_2_Y") || twoPoints)) {
-            srcPoints[0] = Point2f(src.file.getFloat("Affine_0_X"), src.file.getFloat("Affine_0_Y"));
-            srcPoints[1] = Point2f(src.file.getFloat("Affine_1_X"), src.file.getFloat("Affine_1_Y"));
-            if (!twoPoints) srcPoints[2] = Point2f(src.file.getFloat("Affine_2_X"), src.file.getFloat("Affine_2_Y"));
+        QPointF affinePoints[3];
+        if (src.file.affinePoint(0, &affinePoints[0]) &&
+            src.file.affinePoint(1, &affinePoints[1]) &&
+            (twoPoints || src.file.affinePoint(2, &affinePoints[2]))) {
+            for (int i=0; i<(twoPoints ? 2 : 3); i++)
+                srcPoints[i] = OpenCVUtils::toPoint(affinePoints[i]);
         } else {
             const QList<Point2f> landmarks = OpenCVUtils::toPoints(src.file.landmarks());
 
@@ -85,14 +82,8 @@ class Affine : public UntrainableTransform
                 srcPoints[1] = landmarks[1];
                 if (!twoPoints) srcPoints[2] = landmarks[2];
 
-                dst.file.insert("Affine_0_X", landmarks[0].x);
-                dst.file.insert("Affine_0_Y", landmarks[0].y);
-                dst.file.insert("Affine_1_X", landmarks[1].x);
-                dst.file.insert("Affine_1_Y", landmarks[1].y);
-                if (!twoPoints) {
-                    dst.file.insert("Affine_2_X", landmarks[2].x);
-                    dst.file.insert("Affine_2_Y", landmarks[2].y);
-                }
+                for (int i=0; i<(twoPoints ? 2 : 3); i++)
+                    dst.file.setAffinePoint(i, OpenCVUtils::fromPoint(landmarks[i]));
             }
         }
         if (twoPoints) srcPoints[2] = getThirdAffinePoint(srcPoints[0], srcPoints[1]);
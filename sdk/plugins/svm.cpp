@@ -15,6 +15,7 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include <QTemporaryFile>
+#include <QtConcurrentRun>
 #include <opencv2/core/core.hpp>
 #include <opencv2/ml/ml.hpp>
 #include <openbr_plugin.h>
@@ -27,6 +28,13 @@ using namespace br;
  * \ingroup transforms
  * \brief C. Burges. "A tutorial on support vector machines for pattern recognition,"
  * Knowledge Discovery and Data Mining 2(2), 1998.
+ *
+ * Parameters left at -1 are chosen by cross validation over OpenCV's default grids, with every fold of every grid point trained in parallel.
+ * Only the parameters the \em type and \em kernel use are searched: \em C for C_SVC, EPS_SVR and NU_SVR, \em nu for NU_SVC and NU_SVR,
+ * \em p for EPS_SVR and \em gamma for non-linear kernels.
+ * ONE_CLASS and the Poly and Sigmoid kernels, which also depend on \em degree and \em coef0, are tuned with CvSVM::train_auto() instead.
+ * Set \em dualCoordinateDescent to train a linear C_SVC with one-vs-rest hyperplanes instead of libsvm,
+ * which scales to far larger training sets.
  * \author Josh Klontz \cite jklontz
  */
 class SVM : public Transform
@@ -38,6 +46,10 @@ class SVM : public Transform
     Q_PROPERTY(Type type READ get_type WRITE set_type RESET reset_type STORED false)
     Q_PROPERTY(float C READ get_C WRITE set_C RESET reset_C STORED false)
     Q_PROPERTY(float gamma READ get_gamma WRITE set_gamma RESET reset_gamma STORED false)
+    Q_PROPERTY(float p READ get_p WRITE set_p RESET reset_p STORED false)
+    Q_PROPERTY(float nu READ get_nu WRITE set_nu RESET reset_nu STORED false)
+    Q_PROPERTY(int folds READ get_folds WRITE set_folds RESET reset_folds STORED false)
+    Q_PROPERTY(bool dualCoordinateDescent READ get_dualCoordinateDescent WRITE set_dualCoordinateDescent RESET reset_dualCoordinateDescent STORED false)
 
 public:
     /*!
@@ -61,14 +73,250 @@ private:
     BR_PROPERTY(Type, type, C_SVC)
     BR_PROPERTY(float, C, -1)
     BR_PROPERTY(float, gamma, -1)
+    BR_PROPERTY(float, p, -1)
+    BR_PROPERTY(float, nu, -1)
+    BR_PROPERTY(int, folds, 5)
+    BR_PROPERTY(bool, dualCoordinateDescent, false)
 
     cv::SVM svm;
+    cv::Mat weights; // Dual coordinate descent hyperplanes, one per row with the bias in the last column
+    cv::Mat classes; // Scaled labels, a single hyperplane separates classes[0] from classes[1]
     float a, b;
 
+    struct Split
+    {
+        cv::Mat trainData, trainLabels, testData, testLabels;
+    };
+
 public:
     SVM() : a(1), b(0) {}
 
 private:
+    bool isClassifier() const
+    {
+        return (type == C_SVC) || (type == NU_SVC);
+    }
+
+    // Whether the type and kernel depend on the parameter
+    bool uses(int parameter) const
+    {
+        switch (parameter) {
+          case CvSVM::C:     return (type == C_SVC) || (type == EPS_SVR) || (type == NU_SVR);
+          case CvSVM::GAMMA: return int(kernel) != int(CvSVM::LINEAR);
+          case CvSVM::P:     return type == EPS_SVR;
+          case CvSVM::NU:    return (type == NU_SVC) || (type == ONE_CLASS) || (type == NU_SVR);
+        }
+        return false;
+    }
+
+    // Parameters left at -1 that cross validation has to choose
+    bool searches() const
+    {
+        return ((C == -1) && uses(CvSVM::C)) || ((gamma == -1) && uses(CvSVM::GAMMA)) ||
+               ((p == -1) && uses(CvSVM::P)) || ((nu == -1) && uses(CvSVM::NU));
+    }
+
+    // Unsearched parameters that are left at -1 take these values
+    static float defaultValue(int parameter)
+    {
+        switch (parameter) {
+          case CvSVM::P:  return 0.1;
+          case CvSVM::NU: return 0.5;
+        }
+        return 1;
+    }
+
+    CvSVMParams parameters(float C, float gamma, float p, float nu) const
+    {
+        CvSVMParams params;
+        params.kernel_type = kernel;
+        params.svm_type = type;
+        params.C = (C == -1) ? defaultValue(CvSVM::C) : C;
+        params.gamma = (gamma == -1) ? defaultValue(CvSVM::GAMMA) : gamma;
+        params.p = (p == -1) ? defaultValue(CvSVM::P) : p;
+        params.nu = (nu == -1) ? defaultValue(CvSVM::NU) : nu;
+        return params;
+    }
+
+    static inline float dot(const float *a, const float *b, int size)
+    {
+        float result = 0;
+        for (int i=0; i<size; i++)
+            result += a[i] * b[i];
+        return result;
+    }
+
+    /*!
+     * C.-J. Hsieh, K.-W. Chang, C.-J. Lin, S. S. Keerthi, and S. Sundararajan.
+     * "A dual coordinate descent method for large-scale linear SVM," ICML 2008.
+     * L1-loss with the bias folded into the weight vector as a constant feature.
+     */
+    static void trainHyperplane(const cv::Mat &data, const cv::Mat &labels, float positive, float C, const QVector<float> &diagonal, float *w)
+    {
+        const int n = data.rows, d = data.cols;
+        QVector<float> alpha(n, 0);
+        QVector<int> order(n);
+        for (int i=0; i<n; i++) order[i] = i;
+        cv::RNG rng;
+
+        for (int iteration=0; iteration<1000; iteration++) {
+            for (int i=n-1; i>0; i--)
+                std::swap(order[i], order[rng.uniform(0, i+1)]);
+
+            float maxPG = -FLT_MAX, minPG = FLT_MAX;
+            foreach (int i, order) {
+                const float *x = data.ptr<float>(i);
+                const float y = labels.at<float>(i) == positive ? 1 : -1;
+                const float G = y * (dot(w, x, d) + w[d]) - 1;
+
+                float PG = G;
+                if      (alpha[i] == 0) PG = std::min(G, 0.f);
+                else if (alpha[i] == C) PG = std::max(G, 0.f);
+                maxPG = std::max(maxPG, PG);
+                minPG = std::min(minPG, PG);
+                if (fabs(PG) < 1e-12) continue;
+
+                const float previous = alpha[i];
+                alpha[i] = std::min(std::max(previous - G/diagonal[i], 0.f), C);
+                const float delta = (alpha[i] - previous) * y;
+                for (int j=0; j<d; j++)
+                    w[j] += delta * x[j];
+                w[d] += delta;
+            }
+
+            if (maxPG - minPG < 0.1) break;
+        }
+    }
+
+    // One-vs-rest unless there are only two classes
+    static void trainLinear(const cv::Mat &data, const cv::Mat &labels, float C, cv::Mat &weights, cv::Mat &classes)
+    {
+        QList<float> values;
+        for (int i=0; i<labels.rows; i++)
+            if (!values.contains(labels.at<float>(i)))
+                values.append(labels.at<float>(i));
+        qSort(values);
+        if (values.size() < 2) qFatal("SVM::trainLinear expected at least two classes.");
+
+        QVector<float> diagonal(data.rows);
+        for (int i=0; i<data.rows; i++)
+            diagonal[i] = dot(data.ptr<float>(i), data.ptr<float>(i), data.cols) + 1;
+
+        classes = OpenCVUtils::toMat(values, 1);
+        const int models = (values.size() == 2) ? 1 : values.size();
+        weights = cv::Mat::zeros(models, data.cols+1, CV_32FC1);
+        for (int i=0; i<models; i++)
+            trainHyperplane(data, labels, values[models == 1 ? 1 : i], C, diagonal, weights.ptr<float>(i));
+    }
+
+    static void predictLinear(const cv::Mat &data, const cv::Mat &weights, const cv::Mat &classes, cv::Mat &predictions)
+    {
+        cv::Mat scores;
+        cv::gemm(data, weights.colRange(0, data.cols), 1, cv::repeat(weights.col(data.cols).t(), data.rows, 1), 1, scores, cv::GEMM_2_T);
+        predictions.create(data.rows, 1, CV_32FC1);
+        for (int i=0; i<data.rows; i++) {
+            if (weights.rows == 1) {
+                predictions.at<float>(i) = classes.at<float>(scores.at<float>(i, 0) >= 0 ? 1 : 0);
+            } else {
+                cv::Point maxLoc;
+                cv::minMaxLoc(scores.row(i), NULL, NULL, NULL, &maxLoc);
+                predictions.at<float>(i) = classes.at<float>(maxLoc.x);
+            }
+        }
+    }
+
+    void validate(const Split *split, const CvSVMParams *params, double *error) const
+    {
+        cv::Mat predictions;
+        try {
+            if (dualCoordinateDescent) {
+                cv::Mat foldWeights, foldClasses;
+                trainLinear(split->trainData, split->trainLabels, params->C, foldWeights, foldClasses);
+                predictLinear(split->testData, foldWeights, foldClasses, predictions);
+            } else {
+                cv::SVM fold;
+                fold.train(split->trainData, split->trainLabels, cv::Mat(), cv::Mat(), *params);
+                fold.predict(split->testData, predictions);
+            }
+        } catch (...) {
+            *error = DBL_MAX;
+            return;
+        }
+
+        *error = 0;
+        for (int i=0; i<predictions.rows; i++) {
+            const double difference = predictions.at<float>(i) - split->testLabels.at<float>(i);
+            if (isClassifier()) *error += (fabs(difference) > 1e-4);
+            else                *error += difference * difference;
+        }
+    }
+
+    QList<float> grid(float value, int parameter) const
+    {
+        QList<float> values;
+        if ((value != -1) || !uses(parameter)) {
+            values.append(value);
+        } else {
+            const CvParamGrid grid = CvSVM::get_default_grid(parameter);
+            for (double v=grid.min_val; v<grid.max_val; v*=grid.step)
+                values.append(v);
+        }
+        return values;
+    }
+
+    // Cross validates every combination of the searched parameters, returns false if none could be trained
+    bool search(const cv::Mat &data, const cv::Mat &lab, CvSVMParams &best) const
+    {
+        QList<CvSVMParams> candidates;
+        foreach (float c, grid(C, CvSVM::C))
+            foreach (float g, grid(gamma, CvSVM::GAMMA))
+                foreach (float e, grid(p, CvSVM::P))
+                    foreach (float n, grid(nu, CvSVM::NU))
+                        candidates.append(parameters(c, g, e, n));
+
+        QVector<int> order(data.rows);
+        for (int i=0; i<data.rows; i++) order[i] = i;
+        cv::RNG &rng = cv::theRNG();
+        for (int i=data.rows-1; i>0; i--)
+            std::swap(order[i], order[rng.uniform(0, i+1)]);
+
+        QVector<Split> splits(folds);
+        for (int f=0; f<folds; f++) {
+            QList<cv::Mat> trainData, testData;
+            QList<float> trainLabels, testLabels;
+            for (int i=0; i<data.rows; i++) {
+                const int j = order[i];
+                if (i % folds == f) { testData.append(data.row(j)); testLabels.append(lab.at<float>(j)); }
+                else                { trainData.append(data.row(j)); trainLabels.append(lab.at<float>(j)); }
+            }
+            splits[f].trainData = OpenCVUtils::toMat(trainData);
+            splits[f].trainLabels = OpenCVUtils::toMat(trainLabels);
+            splits[f].testData = OpenCVUtils::toMat(testData);
+            splits[f].testLabels = OpenCVUtils::toMat(testLabels);
+        }
+
+        QVector<double> errors(candidates.size() * folds);
+        QList< QFuture<void> > futures;
+        for (int i=0; i<candidates.size(); i++)
+            for (int f=0; f<folds; f++)
+                if (Globals->parallelism) futures.append(QtConcurrent::run(this, &SVM::validate, &splits[f], &candidates[i], &errors[i*folds+f]));
+                else                                                      validate(&splits[f], &candidates[i], &errors[i*folds+f]);
+        if (Globals->parallelism) Globals->trackFutures(futures);
+
+        double bestError = DBL_MAX;
+        for (int i=0; i<candidates.size(); i++) {
+            double error = 0;
+            for (int f=0; f<folds; f++)
+                error = (errors[i*folds+f] == DBL_MAX) ? DBL_MAX : error + errors[i*folds+f];
+            if (error < bestError) {
+                bestError = error;
+                best = candidates[i];
+            }
+        }
+
+        return bestError != DBL_MAX;
+    }
+
     void train(const TemplateList &_data)
     {
         cv::Mat data = OpenCVUtils::toMat(_data.data());
@@ -87,37 +335,80 @@ private:
         if (data.type() != CV_32FC1)
             qFatal("SVM::train expected single channel floating point training data.");
 
-        CvSVMParams params;
-        params.kernel_type = kernel;
-        params.svm_type = type;
-        params.p = 0.1;
-        params.nu = 0.5;
-        if ((C == -1) || ((gamma == -1) && (int(kernel) != int(CvSVM::LINEAR)))) {
-            try {
-                svm.train_auto(data, lab, cv::Mat(), cv::Mat(), params, 5);
-            } catch (...) {
+        if (dualCoordinateDescent) {
+            if ((int(kernel) != int(CvSVM::LINEAR)) || (type != C_SVC))
+                qFatal("SVM::train dual coordinate descent requires a linear C_SVC.");
+            CvSVMParams best = parameters(C, gamma, p, nu);
+            if ((C == -1) && !search(data, lab, best))
+                qFatal("SVM::train unable to train any cross validation fold.");
+            trainLinear(data, lab, best.C, weights, classes);
+            qDebug("SVM C = %f  Hyperplanes = %d", best.C, weights.rows);
+            return;
+        }
+
+        if (searches()) {
+            const bool automatic = (type == ONE_CLASS) || (int(kernel) == int(CvSVM::POLY)) || (int(kernel) == int(CvSVM::SIGMOID)) || (data.rows < folds);
+            CvSVMParams best;
+            if (automatic) {
+                try {
+                    svm.train_auto(data, lab, cv::Mat(), cv::Mat(), parameters(C, gamma, p, nu), folds);
+                } catch (...) {
+                    qWarning("Some classes do not contain sufficient examples or are not discriminative enough for accurate SVM classification.");
+                    svm.train(data, lab);
+                }
+            } else if (search(data, lab, best)) {
+                svm.train(data, lab, cv::Mat(), cv::Mat(), best);
+            } else {
                 qWarning("Some classes do not contain sufficient examples or are not discriminative enough for accurate SVM classification.");
                 svm.train(data, lab);
             }
         } else {
-            params.C = C;
-            params.gamma = gamma;
-            svm.train(data, lab, cv::Mat(), cv::Mat(), params);
+            svm.train(data, lab, cv::Mat(), cv::Mat(), parameters(C, gamma, p, nu));
         }
 
-        CvSVMParams p = svm.get_params();
-        qDebug("SVM C = %f  Gamma = %f  Support Vectors = %d", p.C, p.gamma, svm.get_support_vector_count());
+        const CvSVMParams params = svm.get_params();
+        qDebug("SVM C = %f  Gamma = %f  P = %f  Nu = %f  Support Vectors = %d", params.C, params.gamma, params.p, params.nu, svm.get_support_vector_count());
     }
 
     void project(const Template &src, Template &dst) const
     {
         dst = src;
-        dst.file.setLabel((svm.predict(src.m().reshape(0, 1)) - b)/a);
+        if (dualCoordinateDescent) {
+            cv::Mat prediction;
+            predictLinear(src.m().reshape(0, 1), weights, classes, prediction);
+            dst.file.setLabel((prediction.at<float>(0) - b)/a);
+        } else {
+            dst.file.setLabel((svm.predict(src.m().reshape(0, 1)) - b)/a);
+        }
+    }
+
+    bool batched() const
+    {
+        return true;
+    }
+
+    void project(const TemplateList &src, TemplateList &dst) const
+    {
+        // Predict every template with one call
+        const cv::Mat data = OpenCVUtils::toMat(src.data());
+        cv::Mat predictions;
+        if (data.rows > 0) {
+            if (dualCoordinateDescent) predictLinear(data, weights, classes, predictions);
+            else                       svm.predict(data, predictions);
+        }
+
+        dst = src;
+        for (int i=0; i<dst.size(); i++)
+            dst[i].file.setLabel((predictions.at<float>(i) - b)/a);
     }
 
     void store(QDataStream &stream) const
     {
         stream << a << b;
+        if (dualCoordinateDescent) {
+            stream << weights << classes;
+            return;
+        }
 
         // Create local file
         QTemporaryFile tempFile;
@@ -137,6 +428,10 @@ private:
     void load(QDataStream &stream)
     {
         stream >> a >> b;
+        if (dualCoordinateDescent) {
+            stream >> weights >> classes;
+            return;
+        }
 
         // Copy local file contents from stream
         QByteArray data;
@@ -14,8 +14,12 @@
  * limitations under the License.                                            *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <QMutexLocker>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <openbr_plugin.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif // __SSE__
 
 using namespace cv;
 using namespace br;
@@ -53,6 +57,7 @@ private:
 
     Mat kReal, kImaginary;
 
+    friend class GaborBank;
     friend class GaborJet;
 
     static void makeWavelet(float lambda, float theta, float psi, float sigma, float gamma, Mat &kReal, Mat &kImaginary)
@@ -113,6 +118,124 @@ private:
 
 BR_REGISTER(Transform, Gabor)
 
+/*!
+ * \ingroup transforms
+ * \brief A bank of gabor wavelets applied in the frequency domain.
+ *
+ * Produces one matrix per wavelet, equivalent to a Gabor transform for each wavelet,
+ * from a single forward DFT of the image and one pointwise multiply and inverse DFT per wavelet.
+ * Kernel spectra are computed once per DFT size and reused.
+ */
+class GaborBank : public UntrainableTransform
+{
+    Q_OBJECT
+    Q_ENUMS(Gabor::Component)
+    Q_PROPERTY(QList<float> lambdas READ get_lambdas WRITE set_lambdas RESET reset_lambdas STORED false)
+    Q_PROPERTY(QList<float> thetas READ get_thetas WRITE set_thetas RESET reset_thetas STORED false)
+    Q_PROPERTY(QList<float> psis READ get_psis WRITE set_psis RESET reset_psis STORED false)
+    Q_PROPERTY(QList<float> sigmas READ get_sigmas WRITE set_sigmas RESET reset_sigmas STORED false)
+    Q_PROPERTY(QList<float> gammas READ get_gammas WRITE set_gammas RESET reset_gammas STORED false)
+    Q_PROPERTY(Gabor::Component component READ get_component WRITE set_component RESET reset_component STORED false)
+    BR_PROPERTY(QList<float>, lambdas, QList<float>())
+    BR_PROPERTY(QList<float>, thetas, QList<float>())
+    BR_PROPERTY(QList<float>, psis, QList<float>())
+    BR_PROPERTY(QList<float>, sigmas, QList<float>())
+    BR_PROPERTY(QList<float>, gammas, QList<float>())
+    BR_PROPERTY(Gabor::Component, component, Gabor::Phase)
+
+    QList<Mat> kReals, kImaginaries;
+    int border; // Largest kernel half-width
+    mutable QHash< QPair<int,int>, QList<Mat> > spectra; // Kernel spectra by DFT size
+    mutable QMutex spectraLock;
+
+    void init()
+    {
+        kReals.clear();
+        kImaginaries.clear();
+        spectra.clear();
+        border = 0;
+        foreach (float lambda, lambdas)
+            foreach (float theta, thetas)
+                foreach (float psi, psis)
+                    foreach (float sigma, sigmas)
+                        foreach (float gamma, gammas) {
+                            Mat kReal, kImaginary;
+                            Gabor::makeWavelet(lambda, theta, psi, sigma, gamma, kReal, kImaginary);
+                            kReals.append(kReal);
+                            kImaginaries.append(kImaginary);
+                            border = std::max(border, std::max(kReal.rows, kReal.cols)/2);
+                        }
+    }
+
+    QList<Mat> kernelSpectra(const Size &size) const
+    {
+        QMutexLocker locker(&spectraLock);
+        const QPair<int,int> key(size.width, size.height);
+        if (!spectra.contains(key)) {
+            QList<Mat> kernels;
+            for (int i=0; i<kReals.size(); i++) {
+                // Complex kernel flipped and wrapped around the origin,
+                // so multiplying spectra gives filter2D's correlation for both components at once.
+                const int ax = kReals[i].cols/2;
+                const int ay = kReals[i].rows/2;
+                Mat kernel(size, CV_32FC2, Scalar::all(0));
+                for (int y=0; y<kReals[i].rows; y++)
+                    for (int x=0; x<kReals[i].cols; x++) {
+                        Vec2f &value = kernel.at<Vec2f>((size.height + ay - y) % size.height, (size.width + ax - x) % size.width);
+                        value[0] = kReals[i].at<float>(y, x);
+                        value[1] = kImaginaries[i].at<float>(y, x);
+                    }
+
+                Mat spectrum;
+                dft(kernel, spectrum);
+                kernels.append(spectrum);
+            }
+            spectra.insert(key, kernels);
+        }
+        return spectra[key];
+    }
+
+    void project(const Template &src, Template &dst) const
+    {
+        if (src.m().channels() != 1) qFatal("GaborBank::project expected single channel source matrix.");
+
+        Mat image;
+        src.m().convertTo(image, CV_32F);
+        const Size paddedSize(image.cols + 2*border, image.rows + 2*border);
+        const Size dftSize(getOptimalDFTSize(paddedSize.width), getOptimalDFTSize(paddedSize.height));
+
+        // The reflected border matches filter2D, the zeros beyond it are never reached by a kernel
+        Mat padded(dftSize, CV_32FC1, Scalar(0));
+        Mat paddedROI = padded(Rect(Point(0, 0), paddedSize));
+        copyMakeBorder(image, paddedROI, border, border, border, border, BORDER_REFLECT_101);
+
+        Mat imageSpectrum;
+        dft(padded, imageSpectrum, DFT_COMPLEX_OUTPUT);
+
+        dst.file = src.file;
+        const Rect roi(border, border, image.cols, image.rows);
+        foreach (const Mat &kernelSpectrum, kernelSpectra(dftSize)) {
+            Mat product, response;
+            mulSpectrums(imageSpectrum, kernelSpectrum, product, 0);
+            dft(product, response, DFT_INVERSE | DFT_SCALE);
+
+            Mat components[2];
+            split(response(roi), components);
+            if      (component == Gabor::Real)      dst.append(components[0]);
+            else if (component == Gabor::Imaginary) dst.append(components[1]);
+            else {
+                Mat magnitude, phase;
+                cartToPolar(components[0], components[1], magnitude, phase);
+                if      (component == Gabor::Magnitude) dst.append(magnitude);
+                else if (component == Gabor::Phase)     dst.append(phase);
+                else                                    qFatal("GaborBank::project invalid component.");
+            }
+        }
+    }
+};
+
+BR_REGISTER(Transform, GaborBank)
+
 /*!
  * \ingroup transforms
  * \brief A vector of gabor wavelets applied at a point.
@@ -153,6 +276,30 @@ class GaborJet : public UntrainableTransform
                         }
     }
 
+    static inline void dot(const float *src, const float *kReal, const float *kImaginary, int size, float &real, float &imaginary)
+    {
+        int i = 0;
+#ifdef __SSE__
+        __m128 accumulateReal = _mm_setzero_ps();
+        __m128 accumulateImaginary = _mm_setzero_ps();
+        for (; i+4<=size; i+=4) {
+            const __m128 s = _mm_loadu_ps(src+i);
+            accumulateReal = _mm_add_ps(accumulateReal, _mm_mul_ps(s, _mm_loadu_ps(kReal+i)));
+            accumulateImaginary = _mm_add_ps(accumulateImaginary, _mm_mul_ps(s, _mm_loadu_ps(kImaginary+i)));
+        }
+
+        float buff[4];
+        _mm_storeu_ps(buff, accumulateReal);
+        real += buff[0] + buff[1] + buff[2] + buff[3];
+        _mm_storeu_ps(buff, accumulateImaginary);
+        imaginary += buff[0] + buff[1] + buff[2] + buff[3];
+#endif // __SSE__
+        for (; i<size; i++) {
+            real += src[i] * kReal[i];
+            imaginary += src[i] * kImaginary[i];
+        }
+    }
+
     static float response(const cv::Mat &src, const QPointF &point, const Mat &kReal, const Mat &kImaginary, Gabor::Component component)
     {
         Rect roi(std::max(std::min((int)(point.x() - kReal.cols/2.f), src.cols - kReal.cols), 0),
@@ -160,17 +307,11 @@ class GaborJet : public UntrainableTransform
                  kReal.cols,
                  kReal.rows);
 
+        // Both components in one pass over the window, src is CV_32FC1
         float real = 0, imaginary = 0, magnitude = 0, phase = 0;
-        if (component != Gabor::Imaginary) {
-            Mat dst;
-            multiply(src(roi), kReal, dst);
-            real = sum(dst)[0];
-        }
-        if (component != Gabor::Real) {
-            Mat dst;
-            multiply(src(roi), kImaginary, dst);
-            imaginary = sum(dst)[0];
-        }
+        for (int y=0; y<roi.height; y++)
+            dot(src.ptr<float>(roi.y + y) + roi.x, kReal.ptr<float>(y), kImaginary.ptr<float>(y), roi.width, real, imaginary);
+
         if ((component == Gabor::Magnitude) || (component == Gabor::Phase)) {
             magnitude = sqrt(real*real + imaginary*imaginary);
             phase = atan2(imaginary, real)*180/CV_PI;
@@ -187,11 +328,15 @@ class GaborJet : public UntrainableTransform
 
     void project(const Template &src, Template &dst) const
     {
+        Mat image;
+        if (src.m().type() == CV_32FC1) image = src;
+        else                            src.m().convertTo(image, CV_32F);
+
         const QList<QPointF> landmarks = src.file.landmarks();
         dst = Mat(landmarks.size(), kReals.size(), CV_32FC1);
         for (int i=0; i<landmarks.size(); i++)
             for (int j=0; j<kReals.size(); j++)
-                    dst.m().at<float>(i,j) = response(src, landmarks[i], kReals[j], kImaginaries[j], component);
+                    dst.m().at<float>(i,j) = response(image, landmarks[i], kReals[j], kImaginaries[j], component);
     }
 };
 